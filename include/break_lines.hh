@@ -25,4 +25,16 @@
 std::vector<std::string> break_lines(const std::string& message,
                                      unsigned int line_width);
 
+// one line of a broken message, as an offset and length into that message
+struct line_span {
+  size_t start, length;
+};
+
+/* Like break_lines, but doesn't copy anything; each line is given as a span
+   of `message`, with any trailing spaces already left out. Spans are
+   appended to `lines`, which is not cleared first. */
+void break_line_spans(const char* message, size_t message_len,
+                      unsigned int line_width,
+                      std::vector<line_span>& lines);
+
 #endif
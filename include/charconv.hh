@@ -18,20 +18,42 @@
 #ifndef CHARCONVHH
 #define CHARCONVHH
 
-#include <functional>
+#include <vector>
 #include "tttp_scancodes.h"
 
-/* if cc is given, it's a function to call when a control code (such as
-   newline) is encountered; it is passed the text so far, and the scancode
-   corresponding to that control code, then conversion continues, outputting
-   to the beginning of outp
-   (returned value - outp) = length of converted text not handled by cc*/
+/* a control code (such as newline) found during conversion; `code` is the key
+   it stands for, `pos` is how many bytes of converted text came before it */
+struct cp437_control {
+  size_t pos;
+  tttp_scancode code;
+};
+
+/* printable characters are written to outp, control codes are appended to
+   `controls` (or dropped, if it's null); outp may be the same as inp, CP437 is
+   never longer than UTF-8
+   returns the end of the converted text */
 uint8_t* convert_utf8_to_cp437(const uint8_t* inp, uint8_t* outp, size_t inlen,
-                               std::function<void(uint8_t* sofar,
-                                                  size_t sofarlen,
-                                                  tttp_scancode code)> cc);
-/* assumes the text contains no control codes; make outp at least 3*inlen bytes
-   long */
+                               std::vector<cp437_control>* controls = nullptr);
+/* goes through text converted by convert_utf8_to_cp437 in order, calling
+   on_text(text, textlen) for each run of text between control codes and
+   on_control(code) for each control code */
+template<class T, class C>
+void for_each_cp437_span(uint8_t* text, uint8_t* text_end,
+                         const std::vector<cp437_control>& controls,
+                         T on_text, C on_control) {
+  size_t start = 0;
+  for(auto& control : controls) {
+    if(control.pos > start) on_text(text + start, control.pos - start);
+    start = control.pos;
+    on_control(control.code);
+  }
+  size_t end = text_end - text;
+  if(end > start) on_text(text + start, end - start);
+}
+/* the exact number of bytes convert_cp437_to_utf8 will output for this text */
+size_t cp437_to_utf8_length(const uint8_t* inp, size_t inlen);
+/* assumes the text contains no control codes; make outp at least
+   cp437_to_utf8_length(inp, inlen) bytes long (3*inlen is always enough) */
 uint8_t* convert_cp437_to_utf8(const uint8_t* inp, uint8_t* outp,size_t inlen);
 
 #endif
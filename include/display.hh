@@ -21,6 +21,8 @@
 #include "tttpclient.hh"
 #include "tttp_scancodes.h"
 
+#include <chrono>
+
 class InputDelegate {
 public:
   virtual void Key(int pressed, tttp_scancode scancode) = 0;
@@ -42,7 +44,23 @@ public:
 class Display {
   InputDelegate* delegate;
   std::string status;
+public:
+  // running totals, cheap enough to always keep; it's up to implementations
+  // to keep them up to date
+  struct Stats {
+    // calls to Update that changed anything
+    uint64_t updates;
+    // frames actually put on the screen
+    uint64_t presents;
+    // updates that were shown as part of a later update's present
+    uint64_t coalesced;
+    // presents that were due, but skipped because we were running behind
+    uint64_t dropped;
+    // time spent turning cells into pixels
+    std::chrono::steady_clock::duration rasterize_time;
+  };
 protected:
+  Stats stats;
   uint32_t glyph_width, glyph_height;
   inline const std::string& GetStatusLine() { return status; }
   // if this is called, then the next time Update or Pump is called, the status
@@ -70,6 +88,7 @@ public:
   // that always returns NULL and does nothing to free
   virtual char* GetOtherClipboardText();
   virtual void FreeOtherClipboardText(char*);
+  inline const Stats& GetStats() const { return stats; }
   inline uint32_t GetCharWidth() const { return glyph_width; }
   inline uint32_t GetCharHeight() const { return glyph_height; }
   inline InputDelegate& GetInputDelegate() {
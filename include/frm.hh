@@ -0,0 +1,43 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRMHH
+#define FRMHH
+
+#include "tttpclient.hh"
+#include "display.hh"
+#include "paint_framebuffer.hh"
+
+/* Paint's .frm files. Version 1 is a width byte and a height byte (each
+   1--254), then the color plane and the glyph plane, uncompressed. Version 2
+   starts with a zero byte (which no version 1 file can), "FRM", a version
+   byte of 2, and the width and height as big-endian 16-bit values; each plane
+   follows, run-length encoded:
+   0--127: copy the next n+1 bytes
+   128--255: repeat the next byte n-126 times
+   Runs may cross from one row into the next, but not from one plane into the
+   other. Both are read and written through a small fixed buffer. */
+namespace FRM {
+  // false: the file could not be read, and `whynot` says why; `out` may have
+  // been resized, but its contents are garbage
+  bool Load(FILE* f, Framebuffer& out, std::string& whynot);
+  // always writes version 2
+  // false: writing failed, and errno says why
+  bool Save(FILE* f, const Framebuffer& canvas);
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOSTCACHEHH
+#define HOSTCACHEHH
+
+#include "tttpclient.hh"
+#include "netsock.hh"
+
+#include <forward_list>
+
+/* A small on-disk cache of resolved addresses, keyed by canonical name. It is
+   purely an optimization; every failure to read or write it is silent. */
+namespace HostCache {
+  // how long a stored lookup remains usable, in seconds
+  static const int64_t TTL = 60 * 60;
+  // false: nothing fresh enough is on file for this canonical name
+  bool Lookup(const std::string& canon_name,
+              std::forward_list<Net::Address>& out);
+  // replaces whatever was on file for this canonical name
+  void Store(const std::string& canon_name,
+             const std::forward_list<Net::Address>& addresses);
+  // call when the addresses on file turned out to be useless
+  void Forget(const std::string& canon_name);
+}
+
+#endif
@@ -0,0 +1,62 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MESSAGELOGHH
+#define MESSAGELOGHH
+
+#include "tttpclient.hh"
+#include "break_lines.hh"
+#include "charconv.hh"
+
+/* The most recent TEXT messages from the server, kept so they can be shown
+   over the terminal instead of vanishing onto standard output. At most
+   MAX_MESSAGES messages of at most MAX_MESSAGE_LENGTH bytes each are kept,
+   so no amount of text from the server can make it grow without bound; once
+   full, each new message replaces the oldest. Every message remembers how it
+   was broken into lines, and only breaks itself again when the width it is
+   drawn at changes. */
+class MessageLog {
+  struct Message {
+    // CP437, with newlines where the server's line breaks were
+    std::string text;
+    // the width `lines` was worked out for, or 0 if it hasn't been
+    unsigned int wrap_width = 0;
+    std::vector<line_span> lines;
+  };
+  std::vector<Message> ring;
+  // where the next message goes once the ring is full
+  size_t next;
+  // reused for every message
+  std::vector<uint8_t> buffer;
+  std::vector<cp437_control> controls;
+public:
+  static constexpr size_t MAX_MESSAGES = 256;
+  static constexpr size_t MAX_MESSAGE_LENGTH = 4096;
+  // including the header row
+  static constexpr unsigned int MAX_PANEL_ROWS = 12;
+  MessageLog();
+  // `data` is UTF-8, as it came from the server; anything past
+  // MAX_MESSAGE_LENGTH is dropped
+  void Add(const uint8_t* data, size_t len);
+  /* Draws a panel showing the newest messages onto a frame of the same layout
+     Display::Update takes. It goes along the bottom, leaving the last row for
+     the status line. Returns the first row it drew on, or `height` if the
+     frame was too small to draw anything. */
+  uint16_t Draw(uint16_t width, uint16_t height, uint8_t* framebuffer);
+};
+
+#endif
@@ -172,6 +172,26 @@ public:
     dirty_left = width; dirty_top = height;
     dirty_right = 0; dirty_bot = 0;
   }
+  // like Update, but only copies the part of the dirty region that falls in
+  // the given view, which goes at the top left of `dst`
+  void UpdateView(Framebuffer& dst, int view_x, int view_y,
+                  int view_w, int view_h) {
+    int l = std::max(dirty_left, view_x);
+    int t = std::max(dirty_top, view_y);
+    int r = std::min(dirty_right, view_x + view_w - 1);
+    int b = std::min(dirty_bot, view_y + view_h - 1);
+    if(l <= r && t <= b) {
+      for(int y = t; y <= b; ++y) {
+        memcpy(dst.GetColorPointer(l - view_x, y - view_y),
+               GetColorPointer(l, y), r - l + 1);
+        memcpy(dst.GetGlyphPointer(l - view_x, y - view_y),
+               GetGlyphPointer(l, y), r - l + 1);
+      }
+      dst.DirtyRegion(l - view_x, t - view_y, r - view_x, b - view_y);
+    }
+    dirty_left = width; dirty_top = height;
+    dirty_right = 0; dirty_bot = 0;
+  }
   void Copy(const Framebuffer& src, int dst_x, int dst_y) {
     DirtyRegion(dst_x, dst_y, dst_x + src.width, dst_y + src.height);
     if(src.width == width && dst_x == 0) {
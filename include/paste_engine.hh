@@ -0,0 +1,60 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PASTEENGINEHH
+#define PASTEENGINEHH
+
+#include "tttpclient.hh"
+#include "charconv.hh"
+
+class Session;
+
+/* Sends pasted text to the server a few chunks at a time, once per trip
+   through the main loop and only while the socket can take more, so that a huge
+   paste neither freezes the display nor floods the connection. A paste in
+   progress is bracketed by tttp_client_begin_paste/end_paste, and shows its
+   progress on the status line. */
+class PasteEngine {
+  Session& session;
+  // UTF-8; converted to CP437 in place, a chunk at a time
+  std::string text;
+  size_t pos;
+  // reused for every chunk
+  std::vector<cp437_control> controls;
+  bool active, showing_progress;
+  void Finish();
+public:
+  // how many bytes of UTF-8 to convert and send at once
+  static constexpr size_t CHUNK_SIZE = 4096;
+  // how many chunks one Step may send, so the display gets a turn
+  static constexpr int MAX_CHUNKS_PER_STEP = 16;
+  PasteEngine(Session& session);
+  // begins pasting `text`; if a paste is already going, `text` is added to
+  // the end of it
+  void Start(const char* text, size_t len);
+  // sends the next few chunks, if the socket is ready for them; false when
+  // there is nothing left to paste
+  bool Step();
+  // stops the paste where it is, and tells the server it's over
+  void Cancel();
+  // forgets the paste without telling the server, for when the connection it
+  // was going to is gone
+  void Abandon();
+  inline bool IsActive() const { return active; }
+};
+
+#endif
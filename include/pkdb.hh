@@ -21,9 +21,15 @@
 #include "tttpclient.hh"
 #include "tttp_common.h"
 
+#include <vector>
+
 class Display;
 
 namespace PKDB {
+  // starts opening the database and loading the keys on another thread, so
+  // that it can happen while the window is being set up; Init collects the
+  // result
+  void StartInit();
   // false: the database could not be initialized, the connection can only
   // proceed without PKDB (so with authentication and encryption disabled)
   // may use the passed Display to prompt the user for necessary, potentially
@@ -42,6 +48,31 @@ namespace PKDB {
   // calls die if removing all public keys for that canon name failed, does NOT
   // fail if there were no keys!
   void WipePublicKey(const std::string& canon_name);
+  // how many hosts on file have canonical names starting with `prefix`
+  size_t CountHosts(const std::string& prefix);
+  // the canonical names of up to `count` hosts starting with `prefix`, in
+  // sorted order, starting with the `offset`th one
+  // false: the database could not be read
+  bool ListHosts(const std::string& prefix, size_t offset, size_t count,
+                 std::vector<std::string>& out);
+  // counts from Import or Export
+  struct BulkStats {
+    // host keys imported or exported
+    size_t rows = 0;
+    // lines Import could not make sense of; `first_bad_line` is the line
+    // number of the first one (counting from 1), or 0 if there were none
+    size_t bad_lines = 0, first_bad_line = 0;
+  };
+  /* Host key files have one host per line: the canonical name, whitespace,
+     and the base64 public key, as KeyManageDialog copies it. Blank lines and
+     lines starting with # are ignored.
+     Import adds or replaces every host in `in`, all in one transaction.
+     Export writes every host on file to `out`, in sorted order. Either one
+     opens the database if Init hasn't; call Fini when finished.
+     false: it failed, and `whynot` says why; a failed Import changes
+     nothing in the database */
+  bool Import(FILE* in, BulkStats& stats, std::string& whynot);
+  bool Export(FILE* out, BulkStats& stats, std::string& whynot);
   // call when the connection is established and PKDB is no longer needed
   void Fini();
 }
@@ -0,0 +1,58 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RECORDINGHH
+#define RECORDINGHH
+
+#include "tttpclient.hh"
+
+class Display;
+
+/* Session recordings, taken at the level of libtttp's callbacks. Every
+   palette, frame and text callback is written with the time it happened;
+   frames only carry their dirty rectangle. A recording can then be played
+   back into any Display, which makes it possible to benchmark the rendering
+   path against a real session without a server.
+
+   All errors are thrown as std::string. */
+namespace Recording {
+  // begin recording into the file at `path`, replacing it
+  void Start(const char* path);
+  // flush and close the recording, if any
+  void Stop();
+  bool Active();
+  void Palette(const uint8_t colors[48]);
+  // `framedata` is the full frame buffer exactly as libtttp provides it
+  void Frame(uint16_t width, uint16_t height,
+             uint16_t dirty_left, uint16_t dirty_top,
+             uint16_t dirty_width, uint16_t dirty_height,
+             const uint8_t* framedata);
+  void Text(const uint8_t* data, size_t len);
+  struct ReplayStats {
+    uint32_t palettes, frames, texts;
+    // wall time spent, including any waiting done to honor timestamps
+    double seconds;
+  };
+  // If `realtime` is true, events are delivered no earlier than they were
+  // recorded, pumping the display in between. Otherwise, they are delivered
+  // as quickly as the display will accept them. Text events go to
+  // `text_callback`, called with the display as its first argument.
+  ReplayStats Replay(Display& display, const char* path, bool realtime,
+                     void(*text_callback)(void*, const uint8_t*, size_t));
+}
+
+#endif
@@ -22,6 +22,28 @@
 #include "font.hh"
 
 #include <chrono>
+#include <memory>
+
+/* A font, converted into the form SDLSoft_Display draws from. It never changes
+   once built, so any number of displays can share one. */
+class SDLSoft_GlyphData {
+  uint8_t* data;
+  uint32_t pitch;
+  uint32_t glyph_width, glyph_height;
+  bool has_alpha, has_color;
+public:
+  SDLSoft_GlyphData(Font& font);
+  ~SDLSoft_GlyphData();
+  SDLSoft_GlyphData(const SDLSoft_GlyphData&) = delete;
+  SDLSoft_GlyphData& operator=(const SDLSoft_GlyphData&) = delete;
+  inline const uint8_t* GetData() const { return data; }
+  // bytes between GLYPHS, not ROWS of glyphs
+  inline uint32_t GetPitch() const { return pitch; }
+  inline uint32_t GetGlyphWidth() const { return glyph_width; }
+  inline uint32_t GetGlyphHeight() const { return glyph_height; }
+  inline bool HasAlpha() const { return has_alpha; }
+  inline bool HasColor() const { return has_color; }
+};
 
 class SDLSoft_Display : public Display {
   typedef std::chrono::steady_clock clock;
@@ -29,18 +51,27 @@ class SDLSoft_Display : public Display {
   clock::time_point next_frame;
   clock::duration frame_interval;
   bool status_dirty, exposed, has_alpha, has_color;
-  uint8_t* glyphdata;
+  std::shared_ptr<const SDLSoft_GlyphData> glyphs;
+  // cached from `glyphs`
+  const uint8_t* glyphdata;
   uint32_t glyphpitch; // bytes between GLYPHS, not ROWS of glyphs
   uint16_t cur_width, cur_height, dirty_left, dirty_top, dirty_right,dirty_bot;
   uint16_t prev_status_len;
+  // updates since the last present
+  uint32_t pending_updates;
   SDL_Window* window;
   SDL_Renderer* renderer;
   SDL_Texture* frametexture;
   SDL_Texture* statustexture;
   SDL_Texture* overlaytexture;
   int overlay_x, overlay_y, overlay_w, overlay_h;
+  // the overlay is never drawn outside this; no limit if overlay_clip_w < 0
+  int overlay_clip_x, overlay_clip_y, overlay_clip_w, overlay_clip_h;
   int overlay_source_w, overlay_source_h;
   uint8_t palette[48];
+  // reads the X11 PRIMARY selection without xclip, when possible
+  struct PrimarySelection;
+  std::unique_ptr<PrimarySelection> primary_selection;
   void DrawGlyph(uint8_t color, uint8_t glyph,
                  uint8_t* outbase, uint32_t pitch,
                  const uint8_t* palette);
@@ -66,6 +97,9 @@ public:
   // max_fps < 0 := try to do vsync
   // max_fps == 0 := unlimited framerate
   SDLSoft_Display(Font& font, const char* title, bool accel, float max_fps);
+  // for additional windows that use the same font as an existing one
+  SDLSoft_Display(std::shared_ptr<const SDLSoft_GlyphData> glyphs,
+                  const char* title, bool accel, float max_fps);
   ~SDLSoft_Display() override;
   void SetKeyRepeat(uint32_t delay, uint32_t interval) override;
   void SetPalette(const uint8_t palette[48]) override;
@@ -81,7 +115,17 @@ public:
   void FreeOtherClipboardText(char*) override;
   void SetOverlayTexture(SDL_Texture* tex, int w, int h);
   void SetOverlayRegion(int x, int y, int w, int h);
+  // for an overlay region bigger than the part of the window it belongs in
+  void SetOverlayClip(int x, int y, int w, int h);
+  /* Call after changing the overlay texture's alpha (or taking the overlay
+     away). The overlay's part of the window gets composited again on the
+     next Pump, from the frame texture as it already is; nothing is
+     rasterized again. */
+  void DirtyOverlay();
   inline SDL_Renderer* GetRenderer() const { return renderer; }
+  inline std::shared_ptr<const SDLSoft_GlyphData> GetGlyphData() const {
+    return glyphs;
+  }
 };
 
 #endif
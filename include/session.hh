@@ -0,0 +1,114 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SESSIONHH
+#define SESSIONHH
+
+#include "tttpclient.hh"
+#include "netsock.hh"
+#include "tttp_client.h"
+#include "display.hh"
+#include "paste_engine.hh"
+#include "message_log.hh"
+
+#include <chrono>
+#include <forward_list>
+#include <memory>
+
+
+/* One connection to a server, and the Display it appears on. Every libtttp
+   callback gets its Session as its data pointer, so the socket, the client,
+   pasting and statistics all live here. A few things are still global and
+   assume only one Session is connecting or active at a time: the handshake
+   timing in connection.cc, Recording, and TrafficCapture. */
+class Session {
+  Display& display;
+  Net::SockStream socket;
+  std::forward_list<Net::SockStream*> socks;
+  tttp_client* tttp;
+  bool pasting_enabled;
+  PasteEngine paste;
+  std::unique_ptr<InputDelegate> input_delegate;
+  uint64_t frames_received;
+  // statistics display; `last_*` are the totals as of the last refresh
+  bool stats_enabled;
+  std::chrono::steady_clock::time_point last_stats_time;
+  Display::Stats last_display_stats;
+  uint64_t last_bytes_received, last_frames_received;
+  // server TEXT messages, and the panel that shows them; `frame` is a copy
+  // of the last frame the server sent, so the panel can be drawn over it
+  // and taken away again without the server's help
+  MessageLog messages;
+  bool messages_visible;
+  uint16_t frame_width, frame_height;
+  std::vector<uint8_t> frame, composed_frame;
+  void UpdateStats();
+  void ShowFrame(uint16_t dirty_left, uint16_t dirty_top,
+                 uint16_t dirty_width, uint16_t dirty_height);
+  static void PaletteCallback(void* d, const uint8_t* colors);
+  static void FrameCallback(void* d, uint32_t width, uint32_t height,
+                            uint32_t dirty_left, uint32_t dirty_top,
+                            uint32_t dirty_width, uint32_t dirty_height,
+                            void* framedata);
+  static void KickCallback(void* d, const uint8_t* data, size_t len);
+  static void TextCallback(void* d, const uint8_t* data, size_t len);
+  static void PasteModeCallback(void* d, int enabled);
+public:
+  /* Belongs to connection.cc, which makes the connection, does the handshake,
+     and provides libtttp's socket callbacks. */
+  struct ConnectionState {
+    bool wait_on_next_read = false;
+    std::chrono::steady_clock::time_point wait_end_timepoint;
+    uint64_t bytes_received = 0;
+    // what Reconnect needs to repeat the last successful connection, without
+    // involving the user or the PKDB; only kept when auto_reconnect is set
+    bool remembered = false;
+    std::string username;
+    std::forward_list<Net::Address> targets;
+    bool no_auth, no_crypt;
+    uint32_t flags;
+    uint8_t public_key[TTTP_PUBLIC_KEY_LENGTH];
+    // allocated, locked where possible, and zeroed before it is freed
+    uint8_t* password = nullptr;
+    size_t password_len = 0;
+  } conn;
+  Session(Display& display);
+  ~Session();
+  Session(const Session&) = delete;
+  Session& operator=(const Session&) = delete;
+  inline Display& GetDisplay() { return display; }
+  inline Net::SockStream& GetSocket() { return socket; }
+  // a list containing only our socket, for passing to Net::Select
+  inline std::forward_list<Net::SockStream*>& GetSockets() { return socks; }
+  inline tttp_client* GetClient() { return tttp; }
+  // takes ownership of `client`, and finishes any client we already had
+  void SetClient(tttp_client* client);
+  // call after a successful handshake, to start receiving frames and sending
+  // input
+  void Start();
+  // handles whatever the server has sent, and sends the next piece of any
+  // paste in progress; false when the connection has been closed
+  bool Pump();
+  inline bool IsPastingEnabled() const { return pasting_enabled; }
+  inline PasteEngine& GetPaste() { return paste; }
+  // turns the once-a-second statistics on the status line on or off
+  void ToggleStats();
+  // shows or hides the panel of recent TEXT messages from the server
+  void ToggleMessages();
+};
+
+#endif
@@ -33,26 +33,31 @@
 #endif
 
 class Display;
+class Session;
 
 extern char* autohost, *autouser, *autopassword, *autopassfile;
-extern bool no_auth, no_crypt;
-extern Net::SockStream server_socket;
-extern tttp_client* tttp;
+extern bool no_auth, no_crypt, handshake_stats, auto_reconnect;
 extern int queue_depth;
 
 enum class ConnResult {
   OK, AUTH_FAILURE, CONN_FAILURE, OTHER_FAILURE
 };
 
-bool DoConnectionDialog(Display& display);
-// when this returns OK, `tttp` has a tttp_client handle, a connection is
+bool DoConnectionDialog(Session& session);
+// when this returns OK, `session` has a tttp_client handle, a connection is
 // open, and the handshake has just succeeded
-ConnResult AttemptConnection(Display& display,
+ConnResult AttemptConnection(Session& session,
                              const std::string& canon_name,
                              std::forward_list<Net::Address> targets,
                              const std::string& username,
                              const uint8_t* password, size_t password_len,
                              bool no_crypt);
+// repeats the last successful AttemptConnection, without asking the user
+// anything; only possible when auto_reconnect was set at the time
+// CONN_FAILURE means it's worth trying again later
+ConnResult Reconnect(Session& session, std::string& err);
+// forgets everything Reconnect would have used, zeroing the password
+void ForgetConnection(Session& session);
 void KeyManageDialog(Display& display,
                      const std::string& canon_name);
 
@@ -28,8 +28,12 @@
 #define EOWNERDEAD WSAEPROTONOSUPPORT
 #endif
 #include "mingw.thread.h"
+#include "mingw.mutex.h"
+#include "mingw.condition_variable.h"
 #else
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 #endif
 
 #endif
@@ -0,0 +1,42 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRAFFICCAPTUREHH
+#define TRAFFICCAPTUREHH
+
+#include "tttpclient.hh"
+
+/* Captures raw traffic to and from the server into a pcap file. Each packet
+   is one Send or Receive, prefixed with a direction byte: 0 for data we sent,
+   1 for data we received. (The link type is LINKTYPE_USER0.) Packets are
+   copied into a memory ring and written out by a background thread, so that
+   capturing does not noticeably change the timing of the connection; if the
+   writer can't keep up, packets are dropped and counted rather than
+   stalling.
+
+   Note that, unless encryption is disabled, the captured traffic is mostly
+   ciphertext. */
+namespace TrafficCapture {
+  // begin capturing into the file at `path`, replacing it; throws std::string
+  void Start(const char* path);
+  // write out everything still in the ring, and close the file
+  void Stop();
+  bool Active();
+  void Record(bool received, const void* data, size_t len);
+}
+
+#endif
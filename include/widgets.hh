@@ -49,6 +49,7 @@ class Widget {
     left_neighbor, right_neighbor, tab_neighbor, shift_tab_neighbor;
   std::weak_ptr<Widget> myself; // only valid after added to a Container
   bool focused;
+  bool dirty; // Invalidate has been called since the last Draw
 protected:
   Container& container;
   const int x, y, w, h;
@@ -57,12 +58,18 @@ public:
   Widget(Container& container, int x, int y, int w, int h);
   inline bool IsFocused() const { return focused; }
   virtual ~Widget();
-  virtual void Draw(); // default behavior: call container.DirtyRect
+  /* draws into the container's framebuffer; the container calls this for
+     widgets that have been invalidated, so call Invalidate instead
+     default behavior: call container.DirtyRect, mark us as drawn */
+  virtual void Draw();
+  // asks the container to call Draw before its next Update
+  void Invalidate();
   virtual void OnGainFocus(); // default behavior: update `focused` call `Draw`
   virtual void OnLoseFocus(); // default behavior: update `focused` call `Draw`
   virtual void HandleText(const uint8_t* text, size_t textlen);
   virtual void HandleKey(tttp_scancode scancode); // default: refocus
   virtual void HandleClick(uint16_t button); // default: focus me on left click
+  virtual void HandleScroll(int8_t x, int8_t y); // default: nothing
   /* if IsEnabled() returns false, HandleClick will not be called, and focus
      will "pass through" this widget
      Default is to always return false */
@@ -103,6 +110,7 @@ class Container {
   int width, height, mousex, mousey,
     dirty_left, dirty_top, dirty_right, dirty_bot;
   uint8_t* framebuffer, *glyphbuffer; // glyphbuffer points inside framebuffer
+  bool any_widget_dirty;
   class InputDelegate : public ::InputDelegate {
     Container& container;
   public:
@@ -116,6 +124,8 @@ class Container {
   std::function<bool(tttp_scancode)> key_handler;
   std::function<void(bool)> control_key_state_handler;
   void UnhandledKey(tttp_scancode);
+  // the enabled widget under the given cell, if any
+  std::shared_ptr<Widget> WidgetAt(int x, int y) const;
 public:
   inline void DirtyRect(int x, int y, int w, int h) {
     DirtyRegion(x, y, x+w-1, y+h-1);
@@ -137,11 +147,13 @@ public:
   // handler will be called when the return value of `IsControlHeld` changes
   void SetControlKeyStateHandler(std::function<void(bool)> handler);
   void DrawAll(); // also clears the screen
-  void Update(); // call this before every display.Pump() call
+  /* draws any invalidated widgets, and sends what changed to the display;
+     call this before every display.Pump() call */
+  void Update();
   void RunModal(std::function<bool()> completion_condition,
                 bool already_called_draw_all = false);
   // call this if you had someone else in charge of the Display during a call
-  // to RunModal
+  // to RunModal; our framebuffer is still good, so this only resends it
   void UnNest();
   inline bool IsShiftHeld() const { return left_shift_held||right_shift_held; }
   inline bool IsControlHeld() const {
@@ -155,6 +167,9 @@ public:
     return glyphbuffer + width*y + x;
   }
   inline Display& GetDisplay() const { return display; }
+  // the cell the mouse was last seen in, or -1 if it hasn't been seen yet
+  inline int GetMouseX() const { return mousex; }
+  inline int GetMouseY() const { return mousey; }
 };
 
 class LooseText : public Widget {
@@ -186,6 +201,8 @@ public:
                size_t maxlen = 0);
   ~LabeledField() override;
   const std::string& GetContent() const { return content; }
+  // replaces the content, and puts the cursor at the end
+  void SetContent(const std::string& content);
   void Draw() override;
   void SetIsEnabled(bool enabled);
   bool IsEnabled() const override;
@@ -230,6 +247,41 @@ public:
   inline void SetAction(std::function<void()> action) { this->action = action;}
 };
 
+/* A scrolling list of the hosts in the PKDB. The top row shows the filter;
+   typing narrows the list to hosts that start with what was typed. Only the
+   rows on screen are fetched from the database, and only when the filter or
+   the scroll position changes, so it stays quick with any number of hosts. */
+class HostList : public Widget {
+  std::string filter;
+  // rows[n] is host number top+n of those that match the filter
+  std::vector<std::string> rows;
+  size_t count, top, selected;
+  std::function<void(const std::string&)> select_action, activate_action;
+  inline size_t VisibleRows() const { return h - 1; }
+  void Refilter();
+  void ScrollTo(size_t top);
+  void Select(size_t index);
+  void Activate();
+public:
+  HostList(Container& container, int x, int y, int w, int h);
+  ~HostList() override;
+  // how many hosts match the current filter
+  inline size_t GetCount() const { return count; }
+  // called with the host whenever the selection moves to it
+  inline void SetSelectAction(std::function<void(const std::string&)> action)
+  { select_action = action; }
+  // called with the host when Enter is pressed on it, or it's clicked while
+  // already selected
+  inline void SetActivateAction(std::function<void(const std::string&)> action)
+  { activate_action = action; }
+  void Draw() override;
+  bool IsEnabled() const override;
+  void HandleText(const uint8_t* text, size_t textlen) override;
+  void HandleKey(tttp_scancode scancode) override;
+  void HandleClick(uint16_t button) override;
+  void HandleScroll(int8_t x, int8_t y) override;
+};
+
 class Button : public Widget {
   std::string label;
   std::function<void()> action;
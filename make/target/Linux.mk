@@ -24,7 +24,7 @@ LDFLAGS=-pthread
 LDFLAGS_DEBUG=-ggdb
 LDFLAGS_RELEASE=-flto
 # Libraries.
-LIBS=`sdl2-config --libs` -lpng -lz -lGL -lGLU -lgmp -lsqlite3
+LIBS=`sdl2-config --libs` -lpng -lz -lGL -lGLU -lgmp -lsqlite3 -lX11 -lXfixes
 # Flags passed to the library archiver
 ARFLAGS=-rsc
 
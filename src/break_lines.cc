@@ -17,31 +17,30 @@
 
 #include "break_lines.hh"
 
-std::vector<std::string> break_lines(const std::string& message,
-                                     unsigned int line_width) {
-  std::vector<std::string> lines;
-  auto start = message.begin();
-  auto wordbreak = start;
-  auto here = start;
-  while(here != message.end()) {
-    if(*here == '\n') {
-      lines.emplace_back(start, here);
+void break_line_spans(const char* message, size_t message_len,
+                      unsigned int line_width,
+                      std::vector<line_span>& lines) {
+  size_t first_line = lines.size();
+  size_t start = 0, wordbreak = 0, here = 0;
+  while(here != message_len) {
+    if(message[here] == '\n') {
+      lines.push_back({start, here - start});
       ++here;
       start = wordbreak = here;
     }
-    else if(*here == ' ') {
+    else if(message[here] == ' ') {
       ++here;
       wordbreak = here;
     }
     else {
-      unsigned int line_size_with_this_char = here - start + 1;
+      size_t line_size_with_this_char = here - start + 1;
       if(line_size_with_this_char > line_width) {
         if(start == wordbreak) {
-          lines.emplace_back(start, here);
+          lines.push_back({start, here - start});
           start = wordbreak = here;
         }
         else {
-          lines.emplace_back(start, wordbreak);
+          lines.push_back({start, wordbreak - start});
           start = wordbreak;
         }
       }
@@ -49,12 +48,23 @@ std::vector<std::string> break_lines(const std::string& message,
     }
   }
   if(here != start)
-    lines.emplace_back(start, here);
-  for(auto& line : lines) {
-    while(line.length() > 0 && *line.crbegin() == ' ')
-      line.resize(line.length()-1);
-    if(line.length() > line_width)
+    lines.push_back({start, here - start});
+  for(size_t n = first_line; n < lines.size(); ++n) {
+    auto& line = lines[n];
+    while(line.length > 0 && message[line.start + line.length - 1] == ' ')
+      --line.length;
+    if(line.length > line_width)
       throw std::string("bug in line breaking algorithm");
   }
+}
+
+std::vector<std::string> break_lines(const std::string& message,
+                                     unsigned int line_width) {
+  std::vector<line_span> spans;
+  break_line_spans(message.data(), message.length(), line_width, spans);
+  std::vector<std::string> lines;
+  lines.reserve(spans.size());
+  for(auto& span : spans)
+    lines.emplace_back(message, span.start, span.length);
   return lines;
 }
@@ -61,12 +61,12 @@ void Button::HandleKey(tttp_scancode scancode) {
   case KEY_ENTER: // sigh
   case KEY_SPACE:
     clicked = true;
-    Draw();
+    Invalidate();
     container.Update();
     SDL_Delay(100);
     if(action) action();
     clicked = false;
-    Draw();
+    Invalidate();
     // do not update again
     break;
   default: Widget::HandleKey(scancode);
@@ -77,12 +77,12 @@ void Button::HandleClick(uint16_t button) {
   assert(IsEnabled());
   if(button == TTTP_LEFT_MOUSE_BUTTON) {
     clicked = true;
-    Draw();
+    Invalidate();
     container.Update();
     SDL_Delay(100);
     if(action) action();
     clicked = false;
-    Draw();
+    Invalidate();
     // do not update again
   }
   else Widget::HandleClick(button);
@@ -15,8 +15,6 @@
   along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#define DUMP_TRAFFIC 0
-
 #include "startup.hh"
 
 #include <iostream>
@@ -27,6 +25,10 @@
 #include "mac16.hh"
 #include "widgets.hh"
 #include "pkdb.hh"
+#include "traffic_capture.hh"
+#include "session.hh"
+
+#include <lsx.h>
 
 #ifdef __WIN32__
 // nothing?
@@ -35,47 +37,129 @@
 #include <unistd.h>
 #endif
 
-#if DUMP_TRAFFIC
-static char safe_char(char c) {
-  if(c < 0x20 || c > 0x7E) return '.';
-  else return c;
+static void forget_password(Session::ConnectionState& conn) {
+  if(conn.password != nullptr) {
+    lsx_explicit_bzero(conn.password, conn.password_len);
+#ifndef __WIN32__
+    munlock(conn.password, conn.password_len);
+#endif
+    safe_free(conn.password);
+  }
+  conn.password = nullptr;
+  conn.password_len = 0;
 }
 
-static void hexdump(const char* who, const uint8_t* buf, size_t size) {
-  std::cout << who << ":" << std::endl;
-  for(size_t base = 0; base < size; base += 16) {
-    std::cout << "  ";
-    for(size_t n = base; n < base+16; ++n) {
-      if(n < size) std::cout << std::hex << std::setw(2) << std::setfill('0') << (int)buf[n];
-      else std::cout << "  ";
-      if((n&7)==7) std::cout << "  ";
-      else std::cout << " ";
+static void remember_password(Session::ConnectionState& conn,
+                              const uint8_t* password, size_t password_len) {
+  forget_password(conn);
+  if(password_len == 0) return;
+  conn.password = reinterpret_cast<uint8_t*>(safe_malloc(password_len));
+#ifndef __WIN32__
+  // best effort; keep it out of swap if we're allowed to
+  (void)mlock(conn.password, password_len);
+#endif
+  memcpy(conn.password, password, password_len);
+  conn.password_len = password_len;
+}
+
+void ForgetConnection(Session& session) {
+  auto& conn = session.conn;
+  conn.remembered = false;
+  conn.targets.clear();
+  lsx_explicit_bzero(conn.public_key, sizeof(conn.public_key));
+  forget_password(conn);
+}
+
+/* Handshake timing. Every phase accumulates its wall time, and the part of
+   that spent blocked in Net::Select. The rest is computation (ours or
+   libtttp's) or time the user spent answering a prompt, which gets its own
+   phase. */
+namespace {
+  typedef std::chrono::steady_clock timing_clock;
+  enum HandshakePhase {
+    PHASE_NONE=-1,
+    PHASE_CONNECT=0, PHASE_QUERY, PHASE_KEY_CHECK, PHASE_PROMPT, PHASE_FLAGS,
+    PHASE_AUTH, PHASE_PASSWORD, PHASE_VERIFY,
+    NUM_PHASES
+  };
+  const char* const phase_names[NUM_PHASES] = {
+    "connect", "key query", "key check", "prompts", "flags", "auth",
+    "password", "verify"
+  };
+  struct PhaseTiming {
+    timing_clock::duration total, waiting;
+  } phase_timings[NUM_PHASES];
+  HandshakePhase cur_phase = PHASE_NONE;
+  timing_clock::time_point phase_start;
+  void begin_phase(HandshakePhase phase) {
+    auto now = timing_clock::now();
+    if(cur_phase != PHASE_NONE)
+      phase_timings[cur_phase].total += now - phase_start;
+    cur_phase = phase;
+    phase_start = now;
+  }
+  // put one of these around anything that blocks on the socket
+  class WaitTimer {
+    timing_clock::time_point start;
+  public:
+    WaitTimer() : start(timing_clock::now()) {}
+    ~WaitTimer() {
+      if(cur_phase != PHASE_NONE)
+        phase_timings[cur_phase].waiting += timing_clock::now() - start;
     }
-    std::cout << "|";
-    for(size_t n = base; n < base+16; ++n) {
-      if(n < size) std::cout << safe_char(buf[n]);
-      else std::cout << " ";
+  };
+  // times one call to AttemptConnection, reports when it goes away
+  class HandshakeTimer {
+  public:
+    HandshakeTimer() {
+      for(auto& timing : phase_timings)
+        timing.total = timing.waiting = timing_clock::duration::zero();
+      begin_phase(PHASE_CONNECT);
     }
-    std::cout << "|" << std::endl;
-  }
+    ~HandshakeTimer() {
+      begin_phase(PHASE_NONE);
+      if(!handshake_stats) return;
+      typedef std::chrono::duration<double, std::milli> ms;
+      ms total_total = ms::zero(), total_waiting = ms::zero();
+      std::cerr << "Handshake timing (ms):" << std::endl
+                << "  phase           total    waiting  computing"
+                << std::endl << std::fixed << std::setprecision(3);
+      for(int n = 0; n < NUM_PHASES; ++n) {
+        ms total = phase_timings[n].total;
+        ms waiting = phase_timings[n].waiting;
+        total_total += total;
+        total_waiting += waiting;
+        std::cerr << "  " << std::left << std::setw(10) << phase_names[n]
+                  << std::right << std::setw(11) << total.count()
+                  << std::setw(11) << waiting.count()
+                  << std::setw(11) << (total - waiting).count() << std::endl;
+      }
+      std::cerr << "  " << std::left << std::setw(10) << "(all)"
+                << std::right << std::setw(11) << total_total.count()
+                << std::setw(11) << total_waiting.count()
+                << std::setw(11) << (total_total - total_waiting).count()
+                << std::endl;
+    }
+  };
 }
-#endif
-
-static std::forward_list<Net::SockStream*> socks = {&server_socket};
 
 // Wait up to 1/10 second if no data is forthcoming
 static const std::chrono::steady_clock::duration MAX_TIME_TO_AWAIT_READ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(100));
 
-static bool try_make_connection(Display& display,
+static bool try_make_connection(Session& session,
                                 const Net::Address& address,
                                 int number,
                                 std::string& err) {
+  Display& display = session.GetDisplay();
+  Net::SockStream& server_socket = session.GetSocket();
   auto str = address.ToLongString();
   display.Statusf("Attempting connection to %s (%i)...", str.c_str(), number);
   err.clear();
   Net::IOResult res = server_socket.Connect(err, address);
   if(res == Net::IOResult::WOULD_BLOCK) {
-    while(Net::Select(nullptr, nullptr, nullptr, nullptr, &socks, nullptr,
+    WaitTimer _;
+    while(Net::Select(nullptr, nullptr, nullptr, nullptr,
+                      &session.GetSockets(), nullptr,
                       nullptr, 3000000)
           .GetWritableSockStreams().empty())
       {}
@@ -93,9 +177,10 @@ static bool try_make_connection(Display& display,
   }
 }
 
-static bool wait_on_next_read = false;
-static std::chrono::steady_clock::time_point wait_end_timepoint;
-static int receive_on_server_socket(void* _display, void* buf, size_t bufsz) {
+static int receive_on_server_socket(void* d, void* buf, size_t bufsz) {
+  Session& session = *reinterpret_cast<Session*>(d);
+  bool& wait_on_next_read = session.conn.wait_on_next_read;
+  auto& wait_end_timepoint = session.conn.wait_end_timepoint;
   size_t len;
   std::string err;
   Net::IOResult res;
@@ -103,13 +188,21 @@ static int receive_on_server_socket(void* _display, void* buf, size_t bufsz) {
     std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now();
     if(now < wait_end_timepoint) {
       size_t timeout_us = std::chrono::duration_cast<std::chrono::microseconds>(wait_end_timepoint - now).count();
-      (void)Net::Select(nullptr,nullptr,nullptr,&socks,nullptr,nullptr,nullptr,
-                        timeout_us);
-      ((Display*)_display)->Pump();
+      {
+        // only the Select is waiting on the network; rendering and input
+        // handling are not
+        WaitTimer _;
+        // a paste in progress wants to know as soon as it can send more
+        (void)Net::Select(nullptr,nullptr,nullptr,&session.GetSockets(),
+                          session.GetPaste().IsActive()
+                          ? &session.GetSockets() : nullptr,
+                          nullptr,nullptr,timeout_us);
+      }
+      session.GetDisplay().Pump();
     }
   }
   len = bufsz;
-  res = server_socket.Receive(err, buf, len);
+  res = session.GetSocket().Receive(err, buf, len);
   switch(res) {
   case Net::IOResult::WOULD_BLOCK:
     if(!wait_on_next_read) {
@@ -125,17 +218,18 @@ static int receive_on_server_socket(void* _display, void* buf, size_t bufsz) {
   case Net::IOResult::OKAY: break;
   }
   wait_on_next_read = false;
+  session.conn.bytes_received += len;
+  if(TrafficCapture::Active()) TrafficCapture::Record(true, buf, len);
   return len;
 }
 
 // TODO: We won't be sending much data, so do we need to worry about buffering?
-static int send_on_server_socket(void*, const void* buf, size_t bufsz) {
-#if DUMP_TRAFFIC
-  hexdump("to server", reinterpret_cast<const uint8_t*>(buf), bufsz);
-#endif
+static int send_on_server_socket(void* d, const void* buf, size_t bufsz) {
+  Session& session = *reinterpret_cast<Session*>(d);
+  if(TrafficCapture::Active()) TrafficCapture::Record(false, buf, bufsz);
   do {
     std::string err;
-    Net::IOResult res = server_socket.Send(err, buf, bufsz);
+    Net::IOResult res = session.GetSocket().Send(err, buf, bufsz);
     switch(res) {
     case Net::IOResult::WOULD_BLOCK: break;
     case Net::IOResult::CONNECTION_CLOSED:
@@ -143,12 +237,14 @@ static int send_on_server_socket(void*, const void* buf, size_t bufsz) {
     case Net::IOResult::ERROR: return -1;
     case Net::IOResult::OKAY: return 0;;
     }
-    (void)Net::Select(nullptr,nullptr,nullptr,nullptr,&socks,nullptr,nullptr);
+    WaitTimer _;
+    (void)Net::Select(nullptr,nullptr,nullptr,nullptr,&session.GetSockets(),
+                      nullptr,nullptr);
   } while(1);
 }
 
 static void fatal(void* d, const char* why) {
-  Display& display = *(Display*)d;
+  Display& display = reinterpret_cast<Session*>(d)->GetDisplay();
   std::string bah = std::string("libtttp error: ") + why;
   std::cerr << bah << std::endl;
   do_modal_error(display, bah);
@@ -156,20 +252,40 @@ static void fatal(void* d, const char* why) {
 }
 
 static void foul(void* d, const char* why) {
-  Display& display = *(Display*)d;
+  Display& display = reinterpret_cast<Session*>(d)->GetDisplay();
   std::string bah = std::string("An error occurred and it's the server's fault: ") + why;
   std::cerr << bah << std::endl;
   do_modal_error(display, bah);
   throw quit_exception();
 }
 
-ConnResult AttemptConnection(Display& display,
+static void make_client(Session& session) {
+  Display& display = session.GetDisplay();
+  session.SetClient(nullptr);
+  tttp_client* tttp = tttp_client_init(&session,
+                                       receive_on_server_socket,
+                                       send_on_server_socket,
+                                       nullptr, fatal, foul);
+  session.SetClient(tttp);
+  if(queue_depth > 0)
+    tttp_client_set_queue_depth(tttp, queue_depth);
+  tttp_client_set_mouse_resolution(tttp,
+                                   display.GetCharWidth(),
+                                   display.GetCharHeight());
+}
+
+ConnResult AttemptConnection(Session& session,
                              const std::string& canon_name,
                              std::forward_list<Net::Address> targets,
                              const std::string& username,
                              const uint8_t* password_pointer,
                              size_t password_len, bool no_crypt) {
+  HandshakeTimer timer;
+  Display& display = session.GetDisplay();
+  Net::SockStream& server_socket = session.GetSocket();
+  auto& socks = session.GetSockets();
   bool server_sent_key = false;
+  ForgetConnection(session);
   server_socket.Close();
 #ifdef __WIN32__
   HANDLE passhandle = nullptr;
@@ -233,7 +349,7 @@ ConnResult AttemptConnection(Display& display,
   int idx = 0;
   std::string err;
   for(const auto& address : targets) {
-    if(try_make_connection(display, address, ++idx, err)) {
+    if(try_make_connection(session, address, ++idx, err)) {
       success = true;
       break;
     }
@@ -245,20 +361,10 @@ ConnResult AttemptConnection(Display& display,
     return ConnResult::CONN_FAILURE;
   }
   display.Statusf("Performing handshake...");
+  begin_phase(PHASE_QUERY);
   // we have a connection, do the handshake
-  if(tttp) {
-    tttp_client_fini(tttp);
-    tttp = nullptr;
-  }
-  tttp = tttp_client_init(&display,
-                          receive_on_server_socket,
-                          send_on_server_socket,
-                          nullptr, fatal, foul);
-  if(queue_depth > 0)
-    tttp_client_set_queue_depth(tttp, queue_depth);
-  tttp_client_set_mouse_resolution(tttp,
-                                   display.GetCharWidth(),
-                                   display.GetCharHeight());
+  make_client(session);
+  tttp_client* tttp = session.GetClient();
   uint8_t public_key[TTTP_PUBLIC_KEY_LENGTH];
   tttp_handshake_result res;
   if(!no_auth) {
@@ -268,8 +374,11 @@ ConnResult AttemptConnection(Display& display,
       case TTTP_HANDSHAKE_REJECTED:
       case TTTP_HANDSHAKE_ADVANCE: break;
       case TTTP_HANDSHAKE_CONTINUE:
-        (void)Net::Select(nullptr,nullptr,nullptr,
-                          &socks,nullptr,nullptr,nullptr);
+        {
+          WaitTimer _;
+          (void)Net::Select(nullptr,nullptr,nullptr,
+                            &socks,nullptr,nullptr,nullptr);
+        }
         break;
       default:
         server_socket.Close();
@@ -278,6 +387,7 @@ ConnResult AttemptConnection(Display& display,
         return ConnResult::OTHER_FAILURE;
       }
     } while(res != TTTP_HANDSHAKE_REJECTED && res != TTTP_HANDSHAKE_ADVANCE);
+    begin_phase(PHASE_KEY_CHECK);
     server_sent_key = (res == TTTP_HANDSHAKE_ADVANCE);
     if(res == TTTP_HANDSHAKE_REJECTED) {
       if(!PKDB::GetPublicKey(canon_name, public_key)) {
@@ -298,7 +408,8 @@ ConnResult AttemptConnection(Display& display,
         CLOSE_AUTOPASSFILE();
         return ConnResult::OTHER_FAILURE;
       }
-      else if(!Widgets::ModalConfirm(display, "This server is refusing to authenticate itself. Its identity cannot be proven. Encryption is still technically possible, but there's no way to know who you're actually communicating with.\n\nAre you sure you want to continue connecting?")) {
+      begin_phase(PHASE_PROMPT);
+      if(!Widgets::ModalConfirm(display, "This server is refusing to authenticate itself. Its identity cannot be proven. Encryption is still technically possible, but there's no way to know who you're actually communicating with.\n\nAre you sure you want to continue connecting?")) {
         server_socket.Close();
         CLOSE_AUTOPASSFILE();
         return ConnResult::OTHER_FAILURE;
@@ -324,6 +435,7 @@ ConnResult AttemptConnection(Display& display,
         char fingerprint[TTTP_FINGERPRINT_BUFFER_SIZE];
         tttp_get_key_fingerprint(public_key, fingerprint);
         display.Statusf("");
+        begin_phase(PHASE_PROMPT);
         if(Widgets::ModalConfirm(display, std::string("You have never connected to ")+canon_name+" before. Its public key fingerprint, which you can use to confirm the server's identity, is:\n\n"+fingerprint+"\n\nWould you like to remember this key, and continue connecting?"))
           PKDB::AddPublicKey(canon_name, public_key);
         else
@@ -332,6 +444,7 @@ ConnResult AttemptConnection(Display& display,
       }
     }
   }
+  begin_phase(PHASE_FLAGS);
   tttp_client_request_flags(tttp, TTTP_FLAG_PRECISE_MOUSE |
                             (no_crypt ? 0 : TTTP_FLAG_ENCRYPTION));
   do {
@@ -339,8 +452,11 @@ ConnResult AttemptConnection(Display& display,
     switch(res) {
     case TTTP_HANDSHAKE_ADVANCE: break;
     case TTTP_HANDSHAKE_CONTINUE:
-      (void)Net::Select(nullptr,nullptr,nullptr,
-                        &socks,nullptr,nullptr,nullptr);
+      {
+        WaitTimer _;
+        (void)Net::Select(nullptr,nullptr,nullptr,
+                          &socks,nullptr,nullptr,nullptr);
+      }
       break;
     default:
       server_socket.Close();
@@ -385,6 +501,7 @@ ConnResult AttemptConnection(Display& display,
     return ConnResult::OTHER_FAILURE;
   }
   if(!no_crypt && !(tttp_client_get_flags(tttp) & TTTP_FLAG_ENCRYPTION)) {
+    begin_phase(PHASE_PROMPT);
     if(!Widgets::ModalConfirm(display,
                               "The server does not support encryption. This"
                               " connection will NOT be secure.\n\nWould you"
@@ -396,6 +513,7 @@ ConnResult AttemptConnection(Display& display,
     }
   }
   if(!no_auth) {
+    begin_phase(PHASE_AUTH);
     tttp_client_begin_handshake(tttp, username.c_str(), public_key);
     do {
       res = tttp_client_pump_auth(tttp);
@@ -412,8 +530,11 @@ ConnResult AttemptConnection(Display& display,
         display.Statusf("");
         return ConnResult::AUTH_FAILURE;
       case TTTP_HANDSHAKE_CONTINUE:
-        (void)Net::Select(nullptr,nullptr,nullptr,
-                          &socks,nullptr,nullptr,nullptr);
+        {
+          WaitTimer _;
+          (void)Net::Select(nullptr,nullptr,nullptr,
+                            &socks,nullptr,nullptr,nullptr);
+        }
         break;
       default:
         server_socket.Close();
@@ -447,13 +568,17 @@ ConnResult AttemptConnection(Display& display,
         return ConnResult::OTHER_FAILURE;
       }
     }
+    begin_phase(PHASE_PASSWORD);
     tttp_client_provide_password(tttp, password_pointer, password_len);
+    if(auto_reconnect)
+      remember_password(session.conn, password_pointer, password_len);
     if(autopassfile) {
       UNMAP_AUTOPASSFILE();
     }
     CLOSE_AUTOPASSFILE();
   }
   else tttp_client_begin_handshake(tttp, nullptr, public_key);
+  begin_phase(PHASE_VERIFY);
   do {
     res = tttp_client_pump_verify(tttp);
     switch(res) {
@@ -486,8 +611,11 @@ ConnResult AttemptConnection(Display& display,
                            " username or password.");
       return ConnResult::AUTH_FAILURE;
     case TTTP_HANDSHAKE_CONTINUE:
-      (void)Net::Select(nullptr,nullptr,nullptr,
-                        &socks,nullptr,nullptr,nullptr);
+      {
+        WaitTimer _;
+        (void)Net::Select(nullptr,nullptr,nullptr,
+                          &socks,nullptr,nullptr,nullptr);
+      }
       break;
     default:
       server_socket.Close();
@@ -496,6 +624,126 @@ ConnResult AttemptConnection(Display& display,
     }
   } while(res != TTTP_HANDSHAKE_ADVANCE);
   // Connection succeeded!
+  if(auto_reconnect) {
+    auto& conn = session.conn;
+    conn.remembered = true;
+    conn.username = username;
+    conn.targets = std::move(targets);
+    conn.no_auth = no_auth;
+    conn.no_crypt = no_crypt;
+    conn.flags = final_flags;
+    if(!no_auth)
+      memcpy(conn.public_key, public_key, TTTP_PUBLIC_KEY_LENGTH);
+  }
   display.Statusf("");
   return ConnResult::OK;
 }
+
+// runs a handshake step until it stops waiting for the server
+template<class F> static tttp_handshake_result pump_step(Session& session,
+                                                         F step) {
+  tttp_handshake_result res;
+  while((res = step()) == TTTP_HANDSHAKE_CONTINUE) {
+    WaitTimer _;
+    (void)Net::Select(nullptr,nullptr,nullptr,
+                      &session.GetSockets(),nullptr,nullptr,nullptr);
+  }
+  return res;
+}
+
+ConnResult Reconnect(Session& session, std::string& err) {
+  auto& remembered = session.conn;
+  Net::SockStream& server_socket = session.GetSocket();
+  if(!remembered.remembered) {
+    err = "There is no previous connection to repeat.";
+    return ConnResult::OTHER_FAILURE;
+  }
+  HandshakeTimer timer;
+  server_socket.Close();
+  server_socket = std::move(Net::SockStream());
+  bool success = false;
+  int idx = 0;
+  for(const auto& address : remembered.targets) {
+    if(try_make_connection(session, address, ++idx, err)) {
+      success = true;
+      break;
+    }
+  }
+  if(!success) return ConnResult::CONN_FAILURE;
+  session.GetDisplay().Statusf("Performing handshake...");
+  begin_phase(PHASE_QUERY);
+  make_client(session);
+  tttp_client* tttp = session.GetClient();
+  tttp_handshake_result res;
+  if(!remembered.no_auth) {
+    uint8_t public_key[TTTP_PUBLIC_KEY_LENGTH];
+    res = pump_step(session, [&]{
+        return tttp_client_query_server(tttp, public_key, nullptr, nullptr);
+      });
+    if(res != TTTP_HANDSHAKE_ADVANCE && res != TTTP_HANDSHAKE_REJECTED) {
+      server_socket.Close();
+      err = "The handshake failed.";
+      return ConnResult::CONN_FAILURE;
+    }
+    // a server that hides its key, or won't give one, gets checked against
+    // the key we verified last time during the handshake itself
+    if(res == TTTP_HANDSHAKE_ADVANCE
+       && !tttp_key_is_null_public_key(public_key)
+       && memcmp(public_key, remembered.public_key, TTTP_PUBLIC_KEY_LENGTH)) {
+      server_socket.Close();
+      err = "The server's public key has changed since we last connected."
+        " Reconnect manually to find out more.";
+      return ConnResult::OTHER_FAILURE;
+    }
+  }
+  begin_phase(PHASE_FLAGS);
+  tttp_client_request_flags(tttp, TTTP_FLAG_PRECISE_MOUSE |
+                            (remembered.no_crypt ? 0 : TTTP_FLAG_ENCRYPTION));
+  res = pump_step(session, [tttp]{ return tttp_client_pump_flags(tttp); });
+  if(res != TTTP_HANDSHAKE_ADVANCE) {
+    server_socket.Close();
+    err = "The handshake failed.";
+    return ConnResult::CONN_FAILURE;
+  }
+  if(tttp_client_get_flags(tttp) != remembered.flags) {
+    // in particular, never silently continue without encryption
+    server_socket.Close();
+    err = "The server's capabilities have changed since we last connected."
+      " Reconnect manually to find out more.";
+    return ConnResult::OTHER_FAILURE;
+  }
+  if(!remembered.no_auth) {
+    begin_phase(PHASE_AUTH);
+    tttp_client_begin_handshake(tttp, remembered.username.c_str(),
+                                remembered.public_key);
+    res = pump_step(session, [tttp]{ return tttp_client_pump_auth(tttp); });
+    if(res == TTTP_HANDSHAKE_REJECTED) {
+      server_socket.Close();
+      err = "The server no longer accepts this username.";
+      return ConnResult::AUTH_FAILURE;
+    }
+    else if(res != TTTP_HANDSHAKE_ADVANCE) {
+      server_socket.Close();
+      err = "The handshake failed.";
+      return ConnResult::CONN_FAILURE;
+    }
+    begin_phase(PHASE_PASSWORD);
+    tttp_client_provide_password(tttp, remembered.password,
+                                 remembered.password_len);
+  }
+  else tttp_client_begin_handshake(tttp, nullptr, remembered.public_key);
+  begin_phase(PHASE_VERIFY);
+  res = pump_step(session, [tttp]{ return tttp_client_pump_verify(tttp); });
+  if(res == TTTP_HANDSHAKE_REJECTED) {
+    server_socket.Close();
+    err = "Authentication failed.";
+    return ConnResult::AUTH_FAILURE;
+  }
+  else if(res != TTTP_HANDSHAKE_ADVANCE) {
+    server_socket.Close();
+    err = "The handshake failed.";
+    return ConnResult::CONN_FAILURE;
+  }
+  session.GetDisplay().Statusf("");
+  return ConnResult::OK;
+}
@@ -16,13 +16,18 @@
  */
 
 #include "startup.hh"
+#include "session.hh"
 #include "widgets.hh"
 #include "modal_error.hh"
 #include "mac16.hh"
 #include "tttp_common.h"
 #include "charconv.hh"
+#include "host_cache.hh"
+#include "pkdb.hh"
+#include "threads.hh"
 
 #include <algorithm>
+#include <atomic>
 #include <regex>
 #include <lsx.h>
 
@@ -112,18 +117,82 @@ public:
   bool operator()(const Net::Address& addr) { return !addr.IsLoopback(); }
 };
 
+/* A lookup running on its own thread. The thread shares ownership of the job,
+   so an abandoned lookup (e.g. the user quit while it was in progress) can
+   simply be detached. */
+namespace {
+  struct ResolveJob {
+    std::string host, canon_name, error;
+    uint16_t port;
+    std::forward_list<Net::Address> result;
+    bool ok;
+    std::atomic<bool> done;
+    ResolveJob(const std::string& host, uint16_t port,
+               const std::string& canon_name)
+      : host(host), canon_name(canon_name), port(port), ok(false),
+        done(false) {}
+  };
+}
+
+static std::shared_ptr<ResolveJob> start_resolve(const std::string& host,
+                                                 uint16_t port,
+                                                 const std::string& canon) {
+  std::shared_ptr<ResolveJob> job
+    = std::make_shared<ResolveJob>(host, port, canon);
+  std::thread([job]() {
+      job->ok = Net::ResolveHost(job->error, job->result, job->host.c_str(),
+                                 job->port);
+      job->done = true;
+    }).detach();
+  return job;
+}
+
+// a lookup refreshing cached addresses we are already using
+static std::shared_ptr<ResolveJob> pending_refresh;
+
+// only the main thread touches the cache file
+static void collect_refresh() {
+  if(pending_refresh && pending_refresh->done) {
+    if(pending_refresh->ok)
+      HostCache::Store(pending_refresh->canon_name, pending_refresh->result);
+    pending_refresh = nullptr;
+  }
+}
+
 static bool resolve(Display& display, std::string& error_out,
                     const std::string& entered_address,
-                    std::string& canon_name_out) {
+                    std::string& canon_name_out, bool& from_cache_out) {
   std::string host;
   uint16_t port;
   if(!extract_port(error_out, entered_address, host, port)) return false;
   canon_name_out = get_canon_name(host, port);
-  display.Statusf("%s", "Looking up host...");
+  collect_refresh();
   connection_targets.clear();
-  bool ret = Net::ResolveHost(error_out, connection_targets, host.c_str(),
-                              port);
-  display.Statusf("");
+  bool ret;
+  from_cache_out = HostCache::Lookup(canon_name_out, connection_targets);
+  if(from_cache_out) {
+    // use what we have now, and see if it has changed in the meantime
+    if(!pending_refresh)
+      pending_refresh = start_resolve(host, port, canon_name_out);
+    ret = true;
+  }
+  else {
+    display.Statusf("%s", "Looking up host...");
+    std::shared_ptr<ResolveJob> job = start_resolve(host, port,
+                                                    canon_name_out);
+    DiscardingInputDelegate del;
+    display.SetInputDelegate(&del);
+    while(!job->done) display.Pump(true, 50);
+    display.SetInputDelegate(nullptr);
+    display.Statusf("");
+    ret = job->ok;
+    if(ret) {
+      connection_targets = std::move(job->result);
+      if(connection_targets.cbegin() != connection_targets.cend())
+        HostCache::Store(canon_name_out, connection_targets);
+    }
+    else error_out = std::move(job->error);
+  }
   if(ret && connection_targets.cbegin() == connection_targets.cend()) {
     ret = false;
     error_out = "There are no addresses associated with that name. At least, none that we can try to connect to from this machine.";
@@ -150,9 +219,14 @@ static bool valid_hostname_char(uint8_t c) {
     || c == '[' || c == ']';
 }
 
-bool DoConnectionDialog(Display& display) {
-  Widgets::Container container(display, 80, 9);
+bool DoConnectionDialog(Session& session) {
+  Display& display = session.GetDisplay();
+  // hosts we've connected to before can be picked from a list below the
+  // usual fields
+  bool show_host_list = !autohost && !no_auth && PKDB::CountHosts("") > 0;
+  Widgets::Container container(display, 80, show_host_list ? 20 : 9);
   std::string connection_user, connection_pass, canon_name;
+  bool from_cache = false;
   if(autohost) {
     std::string err;
     const char* p = autohost;
@@ -171,7 +245,7 @@ bool DoConnectionDialog(Display& display) {
     display.SetInputDelegate(&del);
     container.Update();
     display.SetInputDelegate(nullptr);
-    if(!resolve(display, err, autohost, canon_name)) {
+    if(!resolve(display, err, autohost, canon_name, from_cache)) {
       Widgets::ModalInfo(display, std::string("The address entered on the"
                                               " command line could not be"
                                               " used.\n\n") + err,
@@ -191,7 +265,7 @@ bool DoConnectionDialog(Display& display) {
     }
     DiscardingInputDelegate del;
     display.SetInputDelegate(&del);
-    auto result = AttemptConnection(display,
+    auto result = AttemptConnection(session,
                                     autohost,
                                     connection_targets,
                                     autouser ? autouser : "",
@@ -202,6 +276,9 @@ bool DoConnectionDialog(Display& display) {
                                     autopassword ? strlen(autopassword) : 0,
                                     no_crypt);
     display.SetInputDelegate(nullptr);
+    if(result == ConnResult::CONN_FAILURE && from_cache)
+      HostCache::Forget(canon_name);
+    collect_refresh();
     return result == ConnResult::OK;
   }
   else {
@@ -282,7 +359,7 @@ bool DoConnectionDialog(Display& display) {
               container.UnNest();
             });
           connect_button->SetIsEnabled(true);
-          connect_button->Draw();
+          connect_button->Invalidate();
         }
         else {
           connect_button->SetLabel("Connect (secure)");
@@ -290,7 +367,7 @@ bool DoConnectionDialog(Display& display) {
               connecting = true;
             });
           connect_button->SetIsEnabled(!no_crypt);
-          connect_button->Draw();
+          connect_button->Invalidate();
         }
       };
       container.SetControlKeyStateHandler(ctrl_handler);
@@ -298,15 +375,31 @@ bool DoConnectionDialog(Display& display) {
     container.AddWidget(cancel_button);
     container.AddWidget(connect_no_crypt_button);
     container.AddWidget(connect_button);
+    std::shared_ptr<Widgets::HostList> host_list;
+    if(show_host_list) {
+      host_list = std::make_shared<Widgets::HostList>(container, 4, 8, 72, 11);
+      host_list->SetSelectAction([&host_widget](const std::string& host) {
+          host_widget->SetContent(host);
+        });
+      container.AddWidget(host_list);
+    }
+    // where Down from the buttons, and Tab from Cancel, go
+    std::shared_ptr<Widgets::Widget> after_buttons = host_widget;
+    if(host_list) after_buttons = host_list;
     host_widget->SetTabNeighbor(user_widget)->SetTabNeighbor(pass_widget)
       ->SetTabNeighbor(connect_no_crypt_button)
       ->SetTabNeighbor(connect_button)->SetTabNeighbor(cancel_button)
-      ->SetTabNeighbor(host_widget);
+      ->SetTabNeighbor(after_buttons);
+    if(host_list) {
+      host_list->SetTabNeighbor(host_widget);
+      host_list->SetUpNeighbor(connect_button);
+      host_list->SetDownNeighbor(host_widget);
+    }
     connect_no_crypt_button->SetUpNeighbor(pass_widget);
     connect_button->SetUpNeighbor(pass_widget);
-    cancel_button->SetDownNeighbor(host_widget);
-    connect_no_crypt_button->SetDownNeighbor(host_widget);
-    connect_button->SetDownNeighbor(host_widget);
+    cancel_button->SetDownNeighbor(after_buttons);
+    connect_no_crypt_button->SetDownNeighbor(after_buttons);
+    connect_button->SetDownNeighbor(after_buttons);
     cancel_button->SetRightNeighbor(connect_no_crypt_button)
       ->SetRightNeighbor(connect_button)->SetRightNeighbor(cancel_button)
       ->SetLeftNeighbor(connect_button)
@@ -340,6 +433,14 @@ bool DoConnectionDialog(Display& display) {
         container.SetFocusedWidget(username_widget);
       };
     }
+    if(host_list) {
+      // picking a host is the same as typing it and pressing Enter
+      host_list->SetActivateAction([&host_widget,next_action]
+                                   (const std::string& host) {
+          host_widget->SetContent(host);
+          next_action();
+        });
+    }
     if(host_widget && host_widget->IsEnabled()) {
       host_widget->SetAction(next_action);
       next_action = [&container,&host_widget]{
@@ -353,7 +454,7 @@ bool DoConnectionDialog(Display& display) {
       if(connecting) {
         std::string err;
         if(!autohost && !resolve(display, err, host_widget->GetContent(),
-                                 canon_name)) {
+                                 canon_name, from_cache)) {
           Widgets::ModalInfo(display, std::string("The address you entered"
                                                   " could not be used.\n\n")
                              + err);
@@ -365,23 +466,27 @@ bool DoConnectionDialog(Display& display) {
                 && !Widgets::ModalConfirm(display, SCARY_WARNING))
           continue;
         else {
-          const uint8_t* pp; size_t pl;
+          const uint8_t* pp = nullptr; size_t pl = 0;
           if(password_widget) password_widget->GetContent(pp, pl);
-          else pl = 0;
-          uint8_t* pp_utf8 = reinterpret_cast<uint8_t*>(safe_malloc(pl*3));
-          size_t pp_utf8_len = convert_cp437_to_utf8(pp, pp_utf8, pl)-pp_utf8;
+          size_t pp_utf8_len = cp437_to_utf8_length(pp, pl);
+          uint8_t* pp_utf8 = reinterpret_cast<uint8_t*>
+            (safe_malloc(pp_utf8_len));
+          convert_cp437_to_utf8(pp, pp_utf8, pl);
           DiscardingInputDelegate del;
           display.SetInputDelegate(&del);
-          auto result = AttemptConnection(display,
+          auto result = AttemptConnection(session,
                                           canon_name,
                                           connection_targets,
                                           username_widget
                                           ? username_widget->GetContent() : "",
-                                          pp, pl,
+                                          pp_utf8, pp_utf8_len,
                                           connecting_insecure);
           display.SetInputDelegate(nullptr);
           lsx_explicit_bzero(pp_utf8, pp_utf8_len);
           safe_free(pp_utf8);
+          if(result == ConnResult::CONN_FAILURE && from_cache)
+            HostCache::Forget(canon_name);
+          collect_refresh();
           switch(result) {
           case ConnResult::OK: return true;
           case ConnResult::AUTH_FAILURE:
@@ -59,16 +59,14 @@ void Container::InputDelegate::MouseButton(int pressed, uint16_t button) {
     if(p) p->HandleClick(button);
   }
   else {
-    for(auto& widget : container.widgets) {
-      if(widget->IsEnabled() && container.mousex >= widget->x
-         && container.mousey >= widget->y
-         && container.mousex < widget->x+widget->w
-         && container.mousey < widget->y+widget->h)
-        widget->HandleClick(button);
-    }
+    auto p = container.WidgetAt(container.mousex, container.mousey);
+    if(p) p->HandleClick(button);
   }
 }
-void Container::InputDelegate::Scroll(int8_t, int8_t) {}
+void Container::InputDelegate::Scroll(int8_t x, int8_t y) {
+  auto p = container.WidgetAt(container.mousex, container.mousey);
+  if(p) p->HandleScroll(x, y);
+}
 
 Container::Container(Display& display, uint16_t width, uint16_t height)
   : left_shift_held(false), right_shift_held(false),
@@ -76,7 +74,8 @@ Container::Container(Display& display, uint16_t width, uint16_t height)
     left_gui_held(false), right_gui_held(false),
     display(display), width(width), height(height), mousex(-1), mousey(-1),
     dirty_left(0), dirty_top(0), dirty_right(width-1), dirty_bot(height-1),
-    framebuffer(NULL), glyphbuffer(NULL), delegate(*this) {
+    framebuffer(NULL), glyphbuffer(NULL), any_widget_dirty(false),
+    delegate(*this) {
   if(width*2*height/height/2 != width) throw std::string("Integer overflow");
   framebuffer = (uint8_t*)safe_calloc(width*2, height);
   glyphbuffer = framebuffer + width*height;
@@ -114,6 +113,15 @@ void Container::SetControlKeyStateHandler(std::function<void(bool)> handler) {
   this->control_key_state_handler = handler;
 }
 
+std::shared_ptr<Widget> Container::WidgetAt(int x, int y) const {
+  for(auto& widget : widgets) {
+    if(widget->IsEnabled() && x >= widget->x && y >= widget->y
+       && x < widget->x+widget->w && y < widget->y+widget->h)
+      return widget;
+  }
+  return nullptr;
+}
+
 void Container::UnhandledKey(tttp_scancode code) {
   if(key_handler) if(key_handler(code)) return;
   switch(code) {
@@ -128,11 +136,16 @@ void Container::DrawAll() {
   memset(framebuffer, BACKGROUND_COLOR, width*height);
   memset(glyphbuffer, ' ', width*height);
   for(auto& w : widgets) w->Draw();
+  any_widget_dirty = false;
   dirty_left = 0; dirty_top = 0;
   dirty_right = width-1; dirty_bot = height-1;
 }
 
 void Container::Update() {
+  if(any_widget_dirty) {
+    for(auto& w : widgets) if(w->dirty) w->Draw();
+    any_widget_dirty = false;
+  }
   if(dirty_left > dirty_right || dirty_top > dirty_bot) return;
   display.Update(width, height, dirty_left, dirty_top,
                  dirty_right-dirty_left+1, dirty_bot-dirty_top+1,
@@ -157,7 +170,7 @@ void Container::RunModal(std::function<bool()> completion_condition,
 
 void Container::UnNest() {
   display.SetInputDelegate(&delegate);
-  DrawAll();
+  DirtyRegion(0, 0, width-1, height-1);
   right_shift_held = left_shift_held = false;
   if(left_control_held || right_control_held) {
     right_control_held = left_control_held = false;
@@ -14,8 +14,13 @@
 # along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 # TODO: parametrize
-bin/tttpclient-release$(EXE): obj/tttpclient.o obj/lsx_bzero.o obj/lsx_random.o obj/lsx_twofish.o obj/lsx_sha256.o obj/tttp_common.o obj/tttp_client.o obj/display.o obj/sdlsoft_display.o obj/font.o obj/blend_table.o obj/charconv.o obj/modal_error.o obj/mac16.o obj/break_lines.o obj/widget.o obj/container.o obj/loose_text.o obj/labeled_field.o obj/secure_labeled_field.o obj/button.o obj/modal_confirm.o obj/modal_info.o obj/connection_dialog.o obj/connection.o obj/pkdb.o obj/key_manage_dialog.o
-bin/tttpclient-debug$(EXE): $(patsubst %.o,%.debug.o,obj/tttpclient.o obj/lsx_bzero.o obj/lsx_random.o obj/lsx_twofish.o obj/lsx_sha256.o obj/tttp_common.o obj/tttp_client.o obj/display.o obj/sdlsoft_display.o obj/font.o obj/blend_table.o obj/charconv.o obj/modal_error.o obj/mac16.o obj/break_lines.o obj/widget.o obj/container.o obj/loose_text.o obj/labeled_field.o obj/secure_labeled_field.o obj/button.o obj/modal_confirm.o obj/modal_info.o obj/connection_dialog.o obj/connection.o obj/pkdb.o obj/key_manage_dialog.o)
+bin/tttpclient-release$(EXE): obj/tttpclient.o obj/lsx_bzero.o obj/lsx_random.o obj/lsx_twofish.o obj/lsx_sha256.o obj/tttp_common.o obj/tttp_client.o obj/display.o obj/sdlsoft_display.o obj/font.o obj/blend_table.o obj/charconv.o obj/modal_error.o obj/mac16.o obj/break_lines.o obj/widget.o obj/container.o obj/loose_text.o obj/labeled_field.o obj/secure_labeled_field.o obj/button.o obj/modal_confirm.o obj/modal_info.o obj/connection_dialog.o obj/connection.o obj/pkdb.o obj/key_manage_dialog.o obj/host_cache.o obj/recording.o obj/traffic_capture.o obj/session.o obj/paste_engine.o obj/host_list.o obj/message_log.o
+bin/tttpclient-debug$(EXE): $(patsubst %.o,%.debug.o,obj/tttpclient.o obj/lsx_bzero.o obj/lsx_random.o obj/lsx_twofish.o obj/lsx_sha256.o obj/tttp_common.o obj/tttp_client.o obj/display.o obj/sdlsoft_display.o obj/font.o obj/blend_table.o obj/charconv.o obj/modal_error.o obj/mac16.o obj/break_lines.o obj/widget.o obj/container.o obj/loose_text.o obj/labeled_field.o obj/secure_labeled_field.o obj/button.o obj/modal_confirm.o obj/modal_info.o obj/connection_dialog.o obj/connection.o obj/pkdb.o obj/key_manage_dialog.o obj/host_cache.o obj/recording.o obj/traffic_capture.o obj/session.o obj/paste_engine.o obj/host_list.o obj/message_log.o)
 
-bin/paint-release$(EXE): obj/paint.o obj/lsx_bzero.o obj/lsx_random.o obj/lsx_twofish.o obj/lsx_sha256.o obj/tttp_common.o obj/tttp_client.o obj/display.o obj/sdlsoft_display.o obj/font.o obj/blend_table.o obj/charconv.o obj/modal_error.o obj/mac16.o obj/break_lines.o obj/widget.o obj/container.o obj/loose_text.o obj/labeled_field.o obj/secure_labeled_field.o obj/button.o obj/modal_confirm.o obj/modal_info.o obj/png_to_sdltexture.o
-bin/paint-debug$(EXE): obj/paint.debug.o obj/lsx_bzero.debug.o obj/lsx_random.debug.o obj/lsx_twofish.debug.o obj/lsx_sha256.debug.o obj/tttp_common.debug.o obj/tttp_client.debug.o obj/display.debug.o obj/sdlsoft_display.debug.o obj/font.debug.o obj/blend_table.debug.o obj/charconv.debug.o obj/modal_error.debug.o obj/mac16.debug.o obj/break_lines.debug.o obj/widget.debug.o obj/container.debug.o obj/loose_text.debug.o obj/labeled_field.debug.o obj/secure_labeled_field.debug.o obj/button.debug.o obj/modal_confirm.debug.o obj/modal_info.debug.o obj/png_to_sdltexture.debug.o
+bin/paint-release$(EXE): obj/paint.o obj/lsx_bzero.o obj/lsx_random.o obj/lsx_twofish.o obj/lsx_sha256.o obj/tttp_common.o obj/tttp_client.o obj/display.o obj/sdlsoft_display.o obj/font.o obj/blend_table.o obj/charconv.o obj/modal_error.o obj/mac16.o obj/break_lines.o obj/widget.o obj/container.o obj/loose_text.o obj/labeled_field.o obj/secure_labeled_field.o obj/button.o obj/modal_confirm.o obj/modal_info.o obj/png_to_sdltexture.o obj/frm.o
+bin/paint-debug$(EXE): obj/paint.debug.o obj/lsx_bzero.debug.o obj/lsx_random.debug.o obj/lsx_twofish.debug.o obj/lsx_sha256.debug.o obj/tttp_common.debug.o obj/tttp_client.debug.o obj/display.debug.o obj/sdlsoft_display.debug.o obj/font.debug.o obj/blend_table.debug.o obj/charconv.debug.o obj/modal_error.debug.o obj/mac16.debug.o obj/break_lines.debug.o obj/widget.debug.o obj/container.debug.o obj/loose_text.debug.o obj/labeled_field.debug.o obj/secure_labeled_field.debug.o obj/button.debug.o obj/modal_confirm.debug.o obj/modal_info.debug.o obj/png_to_sdltexture.debug.o obj/frm.debug.o
+
+bin/tttp-loadgen-release$(EXE): obj/tttp-loadgen.o obj/lsx_bzero.o obj/lsx_random.o obj/lsx_twofish.o obj/lsx_sha256.o obj/tttp_common.o obj/tttp_client.o
+bin/tttp-loadgen-debug$(EXE): obj/tttp-loadgen.debug.o obj/lsx_bzero.debug.o obj/lsx_random.debug.o obj/lsx_twofish.debug.o obj/lsx_sha256.debug.o obj/tttp_common.debug.o obj/tttp_client.debug.o
+bin/lsx-bench-release$(EXE): obj/lsx-bench.o obj/lsx_bzero.o obj/lsx_random.o obj/lsx_twofish.o obj/lsx_sha256.o
+bin/lsx-bench-debug$(EXE): obj/lsx-bench.debug.o obj/lsx_bzero.debug.o obj/lsx_random.debug.o obj/lsx_twofish.debug.o obj/lsx_sha256.debug.o
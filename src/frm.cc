@@ -0,0 +1,186 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frm.hh"
+
+namespace {
+  const uint8_t V2_MAGIC[] = {0, 'F', 'R', 'M', 2};
+  const size_t BUFFER_SIZE = 4096;
+  // the longest literal and the longest run one control byte can describe
+  const size_t MAX_LITERAL = 128, MAX_RUN = 129;
+  class Reader {
+    FILE* f;
+    uint8_t buf[BUFFER_SIZE];
+    size_t pos, len;
+    bool Refill() {
+      pos = 0;
+      len = fread(buf, 1, BUFFER_SIZE, f);
+      return len > 0;
+    }
+  public:
+    Reader(FILE* f) : f(f), pos(0), len(0) {}
+    int Get() {
+      if(pos == len && !Refill()) return EOF;
+      return buf[pos++];
+    }
+    bool Read(uint8_t* out, size_t n) {
+      while(n > 0) {
+        if(pos == len && !Refill()) return false;
+        size_t amount = std::min(n, len - pos);
+        memcpy(out, buf + pos, amount);
+        pos += amount;
+        out += amount;
+        n -= amount;
+      }
+      return true;
+    }
+  };
+  class Writer {
+    FILE* f;
+    uint8_t buf[BUFFER_SIZE];
+    size_t len;
+    bool ok;
+  public:
+    Writer(FILE* f) : f(f), len(0), ok(true) {}
+    bool Flush() {
+      if(ok && len > 0 && fwrite(buf, 1, len, f) != len) ok = false;
+      len = 0;
+      return ok;
+    }
+    void Put(uint8_t c) {
+      if(len == BUFFER_SIZE) Flush();
+      buf[len++] = c;
+    }
+    void Write(const uint8_t* data, size_t n) {
+      while(n > 0) {
+        if(len == BUFFER_SIZE) Flush();
+        size_t amount = std::min(n, BUFFER_SIZE - len);
+        memcpy(buf + len, data, amount);
+        len += amount;
+        data += amount;
+        n -= amount;
+      }
+    }
+  };
+  void encode_plane(Writer& w, const uint8_t* plane, size_t size) {
+    size_t i = 0;
+    while(i < size) {
+      size_t run = 1;
+      while(i + run < size && run < MAX_RUN && plane[i + run] == plane[i])
+        ++run;
+      if(run >= 2) {
+        w.Put(run + 126);
+        w.Put(plane[i]);
+        i += run;
+        continue;
+      }
+      // a literal goes until the next run worth breaking it up for
+      size_t start = i;
+      while(i < size && i - start < MAX_LITERAL
+            && !(i + 2 < size && plane[i] == plane[i+1]
+                 && plane[i] == plane[i+2]))
+        ++i;
+      w.Put(i - start - 1);
+      w.Write(plane + start, i - start);
+    }
+  }
+  bool decode_plane(Reader& r, uint8_t* plane, size_t size) {
+    size_t pos = 0;
+    while(pos < size) {
+      int c = r.Get();
+      if(c == EOF) return false;
+      size_t n;
+      if(c < 128) {
+        n = c + 1;
+        if(n > size - pos || !r.Read(plane + pos, n)) return false;
+      }
+      else {
+        n = c - 126;
+        int value = r.Get();
+        if(n > size - pos || value == EOF) return false;
+        memset(plane + pos, value, n);
+      }
+      pos += n;
+    }
+    return true;
+  }
+}
+
+bool FRM::Load(FILE* f, Framebuffer& out, std::string& whynot) {
+  Reader r(f);
+  int wide = r.Get();
+  if(wide == 0) {
+    uint8_t header[sizeof(V2_MAGIC) - 1 + 4];
+    if(!r.Read(header, sizeof(header))
+       || memcmp(header, V2_MAGIC + 1, sizeof(V2_MAGIC) - 1)) {
+      whynot = "Not a valid FRM";
+      return false;
+    }
+    const uint8_t* dims = header + sizeof(V2_MAGIC) - 1;
+    int32_t width = (dims[0] << 8) | dims[1];
+    int32_t height = (dims[2] << 8) | dims[3];
+    if(width == 0 || height == 0) {
+      whynot = "Not a valid FRM";
+      return false;
+    }
+    // Framebuffer's sizes are 32-bit and include both planes
+    if(int64_t(width) * height * 2 > INT32_MAX) {
+      whynot = "FRM is too large";
+      return false;
+    }
+    out.Resize(width, height, true);
+    size_t plane_size = size_t(width) * height;
+    if(!decode_plane(r, out.GetColorPointer(), plane_size)
+       || !decode_plane(r, out.GetGlyphPointer(), plane_size)) {
+      whynot = "FRM is truncated or corrupted";
+      return false;
+    }
+    // Resize leaves the dirty region alone, and all of this is new
+    out.DirtyWhole();
+    return true;
+  }
+  int high = r.Get();
+  if(wide == EOF || high == EOF || high == 0) {
+    whynot = "Not a valid FRM";
+    return false;
+  }
+  else if(wide == 255 || high == 255) {
+    whynot = "FRM is too large";
+    return false;
+  }
+  out.Resize(wide, high, true);
+  if(!r.Read(out.GetBuffer(), wide*high*2)) {
+    whynot = "Unexpected EOF";
+    return false;
+  }
+  out.DirtyWhole();
+  return true;
+}
+
+bool FRM::Save(FILE* f, const Framebuffer& canvas) {
+  Writer w(f);
+  int32_t width = canvas.GetWidth(), height = canvas.GetHeight();
+  w.Write(V2_MAGIC, sizeof(V2_MAGIC));
+  w.Put(width >> 8);
+  w.Put(width);
+  w.Put(height >> 8);
+  w.Put(height);
+  size_t plane_size = size_t(width) * height;
+  encode_plane(w, canvas.GetColorPointer(), plane_size);
+  encode_plane(w, canvas.GetGlyphPointer(), plane_size);
+  return w.Flush();
+}
@@ -15,25 +15,78 @@
   along with this program. If not, see <http://www.gnu.org/licenses/>.
 ]]
 
+-- the code point of the one UTF-8 character on a line of the .utxt
+local function decode_utf8(l)
+   local a = l:byte(1)
+   if a < 0x80 then return a
+   elseif a < 0xE0 then return (a - 0xC0) * 64 + (l:byte(2) - 0x80)
+   elseif a < 0xF0 then
+      return ((a - 0xE0) * 64 + (l:byte(2) - 0x80)) * 64 + (l:byte(3) - 0x80)
+   else error("cp437_to_utf8.utxt has a character outside the BMP!") end
+end
+
+-- characters that aren't in the .utxt, but look enough like a CP437
+-- character to stand in for it when converting back
+local aliases = {
+   [0x03B2]=0xE1, [0x03A0]=0xE3, [0x220F]=0xE3, [0x2211]=0xE4,
+   [0x03BC]=0xE6, [0x2126]=0xEA, [0x2202]=0xEB, [0x00F0]=0xEB,
+   [0x2205]=0xED, [0x03D5]=0xED, [0x2300]=0xED, [0x00F8]=0xED,
+   [0x2208]=0xEE, [0x20AC]=0xEE,
+}
+
 local f = assert(io.open("src/cp437_to_utf8.utxt","rb"))
 
-local char_map = {}
-local char_table = {}
+local utf8_length = {}
+local utf8_table = {}
+local reverse = {}
+local function add_reverse(code_point, c)
+   assert(reverse[code_point] == nil or reverse[code_point] == c,
+          "two CP437 characters map to the same code point!")
+   reverse[code_point] = c
+end
 local c = 0
 for l in f:lines() do
-   char_map[c] = #char_table
-   for n=1,#l do table.insert(char_table, l:byte(n)) end
-   table.insert(char_table, 0)
+   assert(#l >= 1 and #l <= 4, "cp437_to_utf8.utxt has a bad line!")
+   utf8_length[c] = #l
+   -- four bytes per character, padded with zeroes
+   for n=1,4 do table.insert(utf8_table, l:byte(n) or 0) end
+   -- NUL and printable ASCII don't go in the reverse table, the converter
+   -- handles them itself
+   if c > 0 and (c < 0x20 or c >= 0x7F) then add_reverse(decode_utf8(l), c) end
    c = c + 1
 end
 assert(c == 256, "cp437_to_utf8.utxt wasn't 256 lines long!")
 f:close()
-assert(char_table[255] < 65536, "cp437_to_utf8.utxt was too complicated!")
+for code_point, c in pairs(aliases) do add_reverse(code_point, c) end
+
+-- the reverse table is two-level: reverse_map[code_point>>8] is the block of
+-- reverse_table to look (code_point&255) up in, and block 0 is all zeroes
+local block_of = {}
+local block_count = 1
+for hi=0,255 do
+   for lo=0,255 do
+      if reverse[hi*256+lo] then
+         block_of[hi] = block_count
+         block_count = block_count + 1
+         break
+      end
+   end
+end
+assert(block_count <= 256, "too many blocks in the reverse table!")
 
 f = assert(io.open("include/gen/char_table.hh","wb"))
-f:write("static const uint8_t char_table["..#char_table.."] = {")
-for n=1,#char_table do f:write(char_table[n]..",") end
-f:write("};\nstatic const uint16_t char_map[256] = {")
-for n=0,255 do f:write(char_map[n]..",") end
+f:write("static const uint8_t utf8_length[256] = {")
+for n=0,255 do f:write(utf8_length[n]..",") end
+f:write("};\nstatic const uint8_t utf8_table[1024] = {")
+for n=1,#utf8_table do f:write(utf8_table[n]..",") end
+f:write("};\nstatic const uint8_t reverse_map[256] = {")
+for hi=0,255 do f:write((block_of[hi] or 0)..",") end
+f:write("};\nstatic const uint8_t reverse_table["..(block_count*256).."] = {")
+for lo=0,255 do f:write("0,") end
+for hi=0,255 do
+   if block_of[hi] then
+      for lo=0,255 do f:write((reverse[hi*256+lo] or 0)..",") end
+   end
+end
 f:write("};\n")
 f:close()
@@ -0,0 +1,171 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "host_cache.hh"
+#include "io.hh"
+
+#include <ctime>
+#include <vector>
+#include <type_traits>
+
+/* Addresses are stored as raw Net::Address images. The cache never leaves this
+   machine, and the header records sizeof(Net::Address) so that a build with a
+   different layout just sees an unusable cache. */
+static_assert(std::is_trivially_copyable<Net::Address>::value,
+              "Net::Address must be trivially copyable to be cached");
+
+static const char* HOST_CACHE_FILENAME = "Host Address Cache.dat";
+static const uint8_t HOST_CACHE_MAGIC[4] = {'T','H','C','1'};
+static const size_t MAX_ENTRIES = 64;
+
+namespace {
+  struct Entry {
+    std::string canon_name;
+    int64_t expires;
+    std::vector<Net::Address> addresses;
+  };
+}
+
+static int64_t now() { return (int64_t)std::time(nullptr); }
+
+static bool read_le(FILE* f, uint64_t& out, int bytes) {
+  out = 0;
+  for(int n = 0; n < bytes; ++n) {
+    int c = fgetc(f);
+    if(c == EOF) return false;
+    out |= (uint64_t)c << (n * 8);
+  }
+  return true;
+}
+
+static void write_le(FILE* f, uint64_t in, int bytes) {
+  for(int n = 0; n < bytes; ++n) {
+    fputc((int)(in & 255), f);
+    in >>= 8;
+  }
+}
+
+// false: the cache was missing or damaged; `out` is empty in that case
+static bool load_entries(std::vector<Entry>& out) {
+  out.clear();
+  const char* path = IO::GetConfigFilePath(HOST_CACHE_FILENAME);
+  FILE* f = fopen(path, "rb");
+  safe_free(const_cast<char*>(path));
+  if(f == nullptr) return false;
+  uint8_t magic[4];
+  uint64_t addrsize;
+  bool ok = fread(magic, 1, 4, f) == 4
+    && !memcmp(magic, HOST_CACHE_MAGIC, 4)
+    && read_le(f, addrsize, 4) && addrsize == sizeof(Net::Address);
+  while(ok) {
+    uint64_t expires, namelen, count;
+    if(!read_le(f, expires, 8)) break; // clean end of file
+    Entry entry;
+    entry.expires = (int64_t)expires;
+    ok = read_le(f, namelen, 2);
+    if(!ok) break;
+    entry.canon_name.resize(namelen);
+    ok = fread(&entry.canon_name[0], 1, namelen, f) == namelen
+      && read_le(f, count, 2);
+    if(!ok) break;
+    entry.addresses.resize(count);
+    ok = fread(entry.addresses.data(), sizeof(Net::Address), count, f)==count;
+    if(ok) out.emplace_back(std::move(entry));
+  }
+  fclose(f);
+  if(!ok) out.clear();
+  return ok;
+}
+
+static void save_entries(const std::vector<Entry>& entries) {
+  const char* path = IO::GetConfigFilePath(HOST_CACHE_FILENAME);
+  FILE* f = fopen(path, "wb");
+  if(f == nullptr) {
+    IO::TryCreateConfigDirectory();
+    f = fopen(path, "wb");
+  }
+  safe_free(const_cast<char*>(path));
+  if(f == nullptr) return;
+  fwrite(HOST_CACHE_MAGIC, 1, 4, f);
+  write_le(f, sizeof(Net::Address), 4);
+  for(const auto& entry : entries) {
+    write_le(f, (uint64_t)entry.expires, 8);
+    write_le(f, entry.canon_name.length(), 2);
+    fwrite(entry.canon_name.data(), 1, entry.canon_name.length(), f);
+    write_le(f, entry.addresses.size(), 2);
+    fwrite(entry.addresses.data(), sizeof(Net::Address),
+           entry.addresses.size(), f);
+  }
+  fclose(f);
+}
+
+// also drops anything that has expired
+static void erase_entry(std::vector<Entry>& entries,
+                        const std::string& canon_name) {
+  auto t = now();
+  for(auto it = entries.begin(); it != entries.end();) {
+    if(it->expires <= t || it->canon_name == canon_name)
+      it = entries.erase(it);
+    else
+      ++it;
+  }
+}
+
+bool HostCache::Lookup(const std::string& canon_name,
+                       std::forward_list<Net::Address>& out) {
+  std::vector<Entry> entries;
+  if(!load_entries(entries)) return false;
+  auto t = now();
+  for(const auto& entry : entries) {
+    if(entry.canon_name != canon_name || entry.expires <= t
+       || entry.addresses.empty())
+      continue;
+    out.clear();
+    auto tail = out.before_begin();
+    for(const auto& address : entry.addresses)
+      tail = out.insert_after(tail, address);
+    return true;
+  }
+  return false;
+}
+
+void HostCache::Store(const std::string& canon_name,
+                      const std::forward_list<Net::Address>& addresses) {
+  if(canon_name.length() > 65535) return;
+  std::vector<Entry> entries;
+  load_entries(entries);
+  erase_entry(entries, canon_name);
+  Entry entry;
+  entry.canon_name = canon_name;
+  entry.expires = now() + TTL;
+  for(const auto& address : addresses) {
+    if(entry.addresses.size() >= 65535) break;
+    entry.addresses.push_back(address);
+  }
+  if(entry.addresses.empty()) return;
+  entries.emplace_back(std::move(entry));
+  if(entries.size() > MAX_ENTRIES)
+    entries.erase(entries.begin(), entries.end() - MAX_ENTRIES);
+  save_entries(entries);
+}
+
+void HostCache::Forget(const std::string& canon_name) {
+  std::vector<Entry> entries;
+  if(!load_entries(entries)) return;
+  erase_entry(entries, canon_name);
+  save_entries(entries);
+}
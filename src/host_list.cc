@@ -0,0 +1,163 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "widgets.hh"
+#include "pkdb.hh"
+#include "tttp_common.h"
+
+using namespace Widgets;
+
+HostList::HostList(Container& container, int x, int y, int w, int h)
+  : Widget(container, x, y, w, h), count(0), top(0), selected(0) {
+  Refilter();
+}
+
+HostList::~HostList() {}
+
+void HostList::Refilter() {
+  count = PKDB::CountHosts(filter);
+  selected = 0;
+  top = ~size_t(0); // force ScrollTo to fetch
+  ScrollTo(0);
+}
+
+void HostList::ScrollTo(size_t new_top) {
+  size_t max_top = count > VisibleRows() ? count - VisibleRows() : 0;
+  if(new_top > max_top) new_top = max_top;
+  if(new_top == top) return;
+  top = new_top;
+  if(!PKDB::ListHosts(filter, top, VisibleRows(), rows)) rows.clear();
+  Invalidate();
+}
+
+void HostList::Select(size_t index) {
+  if(index >= count) return;
+  selected = index;
+  if(selected < top) ScrollTo(selected);
+  else if(selected >= top + VisibleRows())
+    ScrollTo(selected - VisibleRows() + 1);
+  Invalidate();
+  if(select_action && selected - top < rows.size())
+    select_action(rows[selected - top]);
+}
+
+void HostList::Activate() {
+  if(activate_action && selected >= top && selected - top < rows.size())
+    activate_action(rows[selected - top]);
+}
+
+void HostList::Draw() {
+  uint8_t* c = container.GetColorPointer(x,y);
+  uint8_t* g = container.GetGlyphPointer(x,y);
+  char header[128];
+  if(filter.empty())
+    snprintf(header, sizeof(header), "Saved hosts (%lu):",
+             (unsigned long)count);
+  else
+    snprintf(header, sizeof(header), "Saved hosts starting with \"%s\" (%lu):",
+             filter.c_str(), (unsigned long)count);
+  size_t header_len = std::min(strlen(header), (size_t)w);
+  memset(c, IsFocused() ? SELECTED_LABEL_COLOR : UNSELECTED_LABEL_COLOR, w);
+  memset(g, ' ', w);
+  memcpy(g, header, header_len);
+  for(size_t row = 0; row < VisibleRows(); ++row) {
+    c = container.GetColorPointer(x, y + 1 + row);
+    g = container.GetGlyphPointer(x, y + 1 + row);
+    memset(g, ' ', w);
+    if(row < rows.size()) {
+      memset(c, top + row != selected ? UNSELECTED_LABEL_COLOR
+             : IsFocused() ? SELECTED_FIELD_COLOR : UNSELECTED_FIELD_COLOR,
+             w);
+      size_t len = std::min(rows[row].length(), (size_t)w - 2);
+      memcpy(g + 1, rows[row].data(), len);
+    }
+    else memset(c, BACKGROUND_COLOR, w);
+  }
+  Widget::Draw();
+}
+
+bool HostList::IsEnabled() const {
+  return count > 0 || !filter.empty();
+}
+
+void HostList::HandleText(const uint8_t* text, size_t textlen) {
+  size_t old_length = filter.length();
+  while(textlen > 0) {
+    if(*text > 0x20 && *text < 0x7F) filter.push_back(*text);
+    ++text; --textlen;
+  }
+  if(filter.length() != old_length) Refilter();
+}
+
+void HostList::HandleKey(tttp_scancode scancode) {
+  switch(scancode) {
+  case KEY_UP:
+    if(selected > 0) Select(selected - 1);
+    else Widget::HandleKey(scancode);
+    break;
+  case KEY_DOWN:
+    if(selected + 1 < count) Select(selected + 1);
+    else Widget::HandleKey(scancode);
+    break;
+  case KEY_PAGE_UP:
+    Select(selected > VisibleRows() ? selected - VisibleRows() : 0);
+    break;
+  case KEY_PAGE_DOWN:
+    if(count > 0) Select(std::min(selected + VisibleRows(), count - 1));
+    break;
+  case KEY_HOME:
+    Select(0);
+    break;
+  case KEY_END:
+    if(count > 0) Select(count - 1);
+    break;
+  case KEY_BACKSPACE:
+    if(!filter.empty()) { filter.pop_back(); Refilter(); }
+    break;
+  case KEY_ESCAPE:
+    if(!filter.empty()) { filter.clear(); Refilter(); }
+    else Widget::HandleKey(scancode);
+    break;
+  case KEY_KEYPAD_ENTER:
+  case KEY_ENTER:
+    Activate();
+    break;
+  default:
+    Widget::HandleKey(scancode);
+  }
+}
+
+void HostList::HandleClick(uint16_t button) {
+  // take focus first; Activate may hand it to another widget, and we must
+  // not steal it back afterward
+  bool was_focused = IsFocused();
+  Widget::HandleClick(button);
+  if(button == TTTP_LEFT_MOUSE_BUTTON) {
+    // the container only calls us for clicks inside our rectangle
+    int row = container.GetMouseY() - y - 1;
+    if(row >= 0 && (size_t)row < rows.size()) {
+      if(was_focused && top + row == selected) Activate();
+      else Select(top + row);
+    }
+  }
+}
+
+void HostList::HandleScroll(int8_t, int8_t dy) {
+  // three rows per notch, up is positive
+  if(dy > 0) ScrollTo(top > (size_t)dy * 3 ? top - dy * 3 : 0);
+  else if(dy < 0) ScrollTo(top + -dy * 3);
+}
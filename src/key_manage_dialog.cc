@@ -65,14 +65,14 @@ void KeyManageDialog(Display& display,
       }
       else
         candidate_widget->SetText(std::string("  ")+fingerbuf);
-      candidate_widget->Draw();
+      candidate_widget->Invalidate();
     }
     else {
       candidate_widget->SetText("  (no key given)");
-      candidate_widget->Draw();
+      candidate_widget->Invalidate();
     }
     change_button->SetIsEnabled(have_key);
-    change_button->Draw();
+    change_button->Invalidate();
   };
   container.AddWidget(candidate_widget);
   auto copy = [&display,&filekey]() {
@@ -71,6 +71,12 @@ void LabeledField::Draw() {
   Widget::Draw();
 }
 
+void LabeledField::SetContent(const std::string& content) {
+  this->content = content;
+  cursor_pos = content.length();
+  Invalidate();
+}
+
 void LabeledField::SetIsEnabled(bool enabled) { this->enabled = enabled; }
 
 bool LabeledField::IsEnabled() const { return enabled; }
@@ -82,27 +88,25 @@ void LabeledField::HandleText(const uint8_t* text, size_t textlen) {
     }
     ++text; --textlen;
   }
-  Draw();
+  Invalidate();
 }
 
 void LabeledField::HandlePaste() {
   char* cbt = container.GetDisplay().GetClipboardText();
   if(!cbt) return;
   auto cbtlen = strlen(cbt);
+  std::vector<cp437_control> controls;
   // overwrite the buffer as we go, it's okay, CP437 is shorter than UTF-8
-  uint8_t* cop = convert_utf8_to_cp437(reinterpret_cast<uint8_t*>(cbt),
-                                       reinterpret_cast<uint8_t*>(cbt),
-                                       cbtlen,
-                                       [this](uint8_t* sofar,
-                                              size_t sofarlen,
-                                              tttp_scancode code){
-                                         HandleText(sofar, sofarlen);
-                                         if(code != KEY_ENTER
-                                            && code != KEY_TAB)
-                                           HandleKey(code);
-                                       });
-  auto outlen = cop - reinterpret_cast<uint8_t*>(cbt);
-  if(outlen > 0) HandleText(reinterpret_cast<uint8_t*>(cbt), outlen);
+  uint8_t* text = reinterpret_cast<uint8_t*>(cbt);
+  uint8_t* end = convert_utf8_to_cp437(text, text, cbtlen, &controls);
+  for_each_cp437_span(text, end, controls,
+                      [this](uint8_t* run, size_t runlen) {
+                        HandleText(run, runlen);
+                      },
+                      [this](tttp_scancode code) {
+                        if(code != KEY_ENTER && code != KEY_TAB)
+                          HandleKey(code);
+                      });
   container.GetDisplay().FreeClipboardText(cbt);
 }
 
@@ -115,22 +119,22 @@ void LabeledField::HandleKey(tttp_scancode scancode) {
     if(container.IsControlHeld()) HandlePaste();
     break;
   case KEY_DELETE:
-    if(cursor_pos < content.length()) { content.erase(cursor_pos, 1); Draw(); }
+    if(cursor_pos < content.length()) { content.erase(cursor_pos, 1); Invalidate(); }
     break;
   case KEY_BACKSPACE:
-    if(cursor_pos > 0) { content.erase(--cursor_pos, 1); Draw(); }
+    if(cursor_pos > 0) { content.erase(--cursor_pos, 1); Invalidate(); }
     break;
   case KEY_LEFT:
-    if(cursor_pos > 0) { --cursor_pos; Draw(); }
+    if(cursor_pos > 0) { --cursor_pos; Invalidate(); }
     break;
   case KEY_RIGHT:
-    if(cursor_pos < content.length()) { ++cursor_pos; Draw(); }
+    if(cursor_pos < content.length()) { ++cursor_pos; Invalidate(); }
     break;
   case KEY_HOME:
-    if(cursor_pos > 0) { cursor_pos = 0; Draw(); }
+    if(cursor_pos > 0) { cursor_pos = 0; Invalidate(); }
     break;
   case KEY_END:
-    if(cursor_pos < content.length()) { cursor_pos = content.length(); Draw();}
+    if(cursor_pos < content.length()) { cursor_pos = content.length(); Invalidate();}
     break;
   case KEY_KEYPAD_ENTER:
   case KEY_ENTER:
@@ -146,21 +150,19 @@ void LabeledField::HandleClick(uint16_t button) {
     char* cbt = container.GetDisplay().GetOtherClipboardText();
     if(!cbt) return;
     auto cbtlen = strlen(cbt);
+    std::vector<cp437_control> controls;
     // overwrite the buffer as we go, it's okay, CP437 is shorter than UTF-8
-    uint8_t* cop = convert_utf8_to_cp437(reinterpret_cast<uint8_t*>(cbt),
-                                         reinterpret_cast<uint8_t*>(cbt),
-                                         cbtlen,
-                                         [this](uint8_t* sofar,
-                                                size_t sofarlen,
-                                                tttp_scancode code){
-                                           HandleText(sofar, sofarlen);
-                                           if(code != KEY_ENTER
-                                              && code != KEY_TAB
-                                              && code != KEY_ESCAPE)
-                                             HandleKey(code);
-                                         });
-    auto outlen = cop - reinterpret_cast<uint8_t*>(cbt);
-    if(outlen > 0) HandleText(reinterpret_cast<uint8_t*>(cbt), outlen);
+    uint8_t* text = reinterpret_cast<uint8_t*>(cbt);
+    uint8_t* end = convert_utf8_to_cp437(text, text, cbtlen, &controls);
+    for_each_cp437_span(text, end, controls,
+                        [this](uint8_t* run, size_t runlen) {
+                          HandleText(run, runlen);
+                        },
+                        [this](tttp_scancode code) {
+                          if(code != KEY_ENTER && code != KEY_TAB
+                             && code != KEY_ESCAPE)
+                            HandleKey(code);
+                        });
     container.GetDisplay().FreeOtherClipboardText(cbt);
   }
   else Widget::HandleClick(button);
@@ -0,0 +1,206 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* lsx-bench checks lsx's Twofish and SHA-256 against known answers, then
+   measures their throughput in the ways a TTTP session uses them: Twofish-256
+   block operations in bulk and as a counter-mode keystream, and SHA-256 over
+   both bulk data and message-sized inputs. It only measures whatever lsx
+   was built with; there are no table-driven or SIMD paths, and no runtime
+   dispatch between them, yet. When there are, they should pass the same
+   checks and be compared with the same numbers. */
+
+#include "tttpclient.hh"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <lsx.h>
+
+extern void die(const char* format, ...) {
+  char error[1920];
+  va_list arg;
+  va_start(arg, format);
+  vsnprintf(error, sizeof(error), format, arg);
+  va_end(arg);
+  throw std::string(error);
+}
+
+typedef std::chrono::steady_clock bench_clock;
+
+// how long to run each benchmark
+static double bench_seconds = 1;
+// keeps the compiler from deciding the results don't matter
+static volatile uint8_t sink;
+
+static void unhex(const char* hex, uint8_t* out) {
+  while(*hex) {
+    unsigned int byte;
+    sscanf(hex, "%2x", &byte);
+    *out++ = (uint8_t)byte;
+    hex += 2;
+  }
+}
+
+static bool check(const char* what, const uint8_t* got, const char* expected,
+                  size_t len) {
+  std::vector<uint8_t> want(len);
+  unhex(expected, want.data());
+  bool ok = !memcmp(got, want.data(), len);
+  std::cout << (ok ? "  ok    " : "  FAIL  ") << what << std::endl;
+  return ok;
+}
+
+static bool known_answers() {
+  std::cout << "Known answer tests:" << std::endl;
+  bool ok = true;
+  uint8_t key[32] = {}, block[16] = {}, out[16], back[16];
+  lsx_twofish_expanded_key expanded;
+  lsx_setup_twofish128(&expanded, key);
+  lsx_encrypt_twofish(&expanded, block, out);
+  ok = check("Twofish-128 encrypt", out, "9F589F5CF6122C32B6BFEC2F2AE8C35A",
+             16) && ok;
+  lsx_decrypt_twofish(&expanded, out, back);
+  ok = check("Twofish-128 decrypt", back, "00000000000000000000000000000000",
+             16) && ok;
+  lsx_destroy_twofish(&expanded);
+  lsx_setup_twofish256(&expanded, key);
+  lsx_encrypt_twofish(&expanded, block, out);
+  ok = check("Twofish-256 encrypt", out, "57FF739D4DC92C1BD7FC01700CC8216F",
+             16) && ok;
+  lsx_decrypt_twofish(&expanded, out, back);
+  ok = check("Twofish-256 decrypt", back, "00000000000000000000000000000000",
+             16) && ok;
+  lsx_destroy_twofish(&expanded);
+  uint8_t hash[LSX_SHA256_HASHBYTES];
+  lsx_calculate_sha256("", 0, hash);
+  ok = check("SHA-256 of nothing", hash, "e3b0c44298fc1c149afbf4c8996fb924"
+             "27ae41e4649b934ca495991b7852b855", 32) && ok;
+  lsx_calculate_sha256("abc", 3, hash);
+  ok = check("SHA-256 of \"abc\"", hash, "ba7816bf8f01cfea414140de5dae2223"
+             "b00361a396177a9cb410ff61f20015ad", 32) && ok;
+  // same thing, fed in pieces that don't line up with the block size
+  static const char* million_a_hash = "cdc76e5c9914fb9281a1c7e284d73e67"
+    "f1809a48a497200e046d39ccc7112cd0";
+  std::vector<uint8_t> as(1000, 'a');
+  lsx_sha256_context ctx;
+  lsx_setup_sha256(&ctx);
+  for(int n = 0; n < 1000; ++n)
+    lsx_input_sha256(&ctx, as.data(), as.size());
+  lsx_finish_sha256(&ctx, hash);
+  lsx_destroy_sha256(&ctx);
+  ok = check("SHA-256 of a million \"a\"s", hash, million_a_hash, 32) && ok;
+  return ok;
+}
+
+// calls `step` until bench_seconds have passed; `step` processes
+// `bytes_per_step` bytes
+template<class F> static void bench(const char* what, size_t bytes_per_step,
+                                    F step) {
+  // warm up
+  for(int n = 0; n < 16; ++n) step();
+  uint64_t steps = 0;
+  auto start = bench_clock::now();
+  auto end = start + std::chrono::duration_cast<bench_clock::duration>
+    (std::chrono::duration<double>(bench_seconds));
+  bench_clock::time_point now;
+  do {
+    // don't read the clock too often
+    for(int n = 0; n < 64; ++n) step();
+    steps += 64;
+  } while((now = bench_clock::now()) < end);
+  double seconds = std::chrono::duration<double>(now - start).count();
+  double mb = steps * bytes_per_step / 1000000.0;
+  std::cout << "  " << std::left << std::setw(36) << what << std::right
+            << std::fixed << std::setprecision(1) << std::setw(10)
+            << mb / seconds << " MB/s" << std::setw(12)
+            << std::setprecision(0) << steps / seconds << " ops/s"
+            << std::endl;
+}
+
+static void benchmarks() {
+  std::cout << "Benchmarks:" << std::endl;
+  uint8_t key[32];
+  for(int n = 0; n < 32; ++n) key[n] = n * 7 + 1;
+  lsx_twofish_expanded_key expanded;
+  lsx_setup_twofish256(&expanded, key);
+  static const size_t BULK_SIZE = 64 * 1024;
+  std::vector<uint8_t> in(BULK_SIZE), out(BULK_SIZE);
+  for(size_t n = 0; n < BULK_SIZE; ++n) in[n] = (uint8_t)(n * 31);
+  bench("Twofish-256 encrypt, 64KiB", BULK_SIZE, [&]{
+      for(size_t n = 0; n < BULK_SIZE; n += 16)
+        lsx_encrypt_twofish(&expanded, &in[n], &out[n]);
+      sink = out[0];
+    });
+  bench("Twofish-256 decrypt, 64KiB", BULK_SIZE, [&]{
+      for(size_t n = 0; n < BULK_SIZE; n += 16)
+        lsx_decrypt_twofish(&expanded, &in[n], &out[n]);
+      sink = out[0];
+    });
+  uint64_t counter = 0;
+  bench("Twofish-256 counter mode, 64KiB", BULK_SIZE, [&]{
+      uint8_t block[16] = {}, stream[16];
+      for(size_t n = 0; n < BULK_SIZE; n += 16) {
+        memcpy(block, &counter, sizeof(counter));
+        ++counter;
+        lsx_encrypt_twofish(&expanded, block, stream);
+        for(int i = 0; i < 16; ++i) out[n + i] = in[n + i] ^ stream[i];
+      }
+      sink = out[0];
+    });
+  lsx_destroy_twofish(&expanded);
+  bench("Twofish-256 key setup", 32, [&]{
+      lsx_setup_twofish256(&expanded, key);
+      lsx_destroy_twofish(&expanded);
+    });
+  uint8_t hash[LSX_SHA256_HASHBYTES];
+  bench("SHA-256, 64KiB", BULK_SIZE, [&]{
+      lsx_calculate_sha256(in.data(), BULK_SIZE, hash);
+      sink = hash[0];
+    });
+  static const size_t small_sizes[] = {16, 64, 256, 1024};
+  for(auto size : small_sizes) {
+    char what[64];
+    snprintf(what, sizeof(what), "SHA-256, %u bytes", (unsigned)size);
+    bench(what, size, [&]{
+        lsx_calculate_sha256(in.data(), size, hash);
+        sink = hash[0];
+      });
+  }
+}
+
+int teg_main(int argc, char* argv[]) {
+  if(argc > 2 || (argc == 2 && !strcmp(argv[1], "-?"))) {
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "  lsx-bench [seconds per benchmark]" << std::endl;
+    return 1;
+  }
+  if(argc == 2) {
+    char* endptr;
+    bench_seconds = strtod(argv[1], &endptr);
+    if(*endptr || endptr == argv[1] || !(bench_seconds > 0)) {
+      std::cerr << "Invalid number of seconds" << std::endl;
+      return 1;
+    }
+  }
+  if(!known_answers()) {
+    std::cout << "Some known answer tests failed; not benchmarking." << std::endl;
+    return 1;
+  }
+  benchmarks();
+  return 0;
+}
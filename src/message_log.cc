@@ -0,0 +1,110 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "message_log.hh"
+#include "widgets.hh"
+#include "startup.hh"
+
+constexpr size_t MessageLog::MAX_MESSAGES;
+constexpr size_t MessageLog::MAX_MESSAGE_LENGTH;
+constexpr unsigned int MessageLog::MAX_PANEL_ROWS;
+
+namespace {
+  const uint8_t HEADER_COLOR = (MAC16_BLACK<<4)|MAC16_WHITE;
+  const char HEADER_TEXT[] = "Server messages (" PMOD "+F11 to hide)";
+  const char EMPTY_TEXT[] = "The server has not sent any messages.";
+  void put_row(uint8_t* colors, uint8_t* glyphs, uint16_t width,
+               uint8_t color, const char* text, size_t len) {
+    memset(colors, color, width);
+    memset(glyphs, ' ', width);
+    // one column of margin on each side
+    if(len > size_t(width - 2)) len = width - 2;
+    memcpy(glyphs + 1, text, len);
+  }
+}
+
+MessageLog::MessageLog() : next(0) {}
+
+void MessageLog::Add(const uint8_t* data, size_t len) {
+  if(len > MAX_MESSAGE_LENGTH) len = MAX_MESSAGE_LENGTH;
+  Message* message;
+  if(ring.size() < MAX_MESSAGES) {
+    ring.emplace_back();
+    message = &ring.back();
+  }
+  else message = &ring[next];
+  next = (next + 1) % MAX_MESSAGES;
+  // an overwritten message's buffers are reused, so a full log stops
+  // allocating altogether
+  buffer.resize(len);
+  controls.clear();
+  uint8_t* end = convert_utf8_to_cp437(data, buffer.data(), len, &controls);
+  message->text.clear();
+  for_each_cp437_span(buffer.data(), end, controls,
+                      [message](const uint8_t* text, size_t textlen) {
+                        message->text.append(reinterpret_cast<const char*>
+                                             (text), textlen);
+                      },
+                      [message](tttp_scancode code) {
+                        if(code == KEY_ENTER) message->text.push_back('\n');
+                        else if(code == KEY_TAB) message->text.push_back(' ');
+                      });
+  message->wrap_width = 0;
+  message->lines.clear();
+}
+
+uint16_t MessageLog::Draw(uint16_t width, uint16_t height,
+                          uint8_t* framebuffer) {
+  if(width < 3 || height < 3) return height;
+  unsigned int rows = height - 1;
+  if(rows > MAX_PANEL_ROWS) rows = MAX_PANEL_ROWS;
+  uint16_t top = height - 1 - rows;
+  uint8_t* colors = framebuffer;
+  uint8_t* glyphs = framebuffer + width * height;
+  put_row(colors + top * width, glyphs + top * width, width, HEADER_COLOR,
+          HEADER_TEXT, sizeof(HEADER_TEXT)-1);
+  unsigned int wrap_width = width - 2;
+  // fill from the bottom up, newest first, until we run out of room
+  unsigned int row = height - 1;
+  for(size_t back = 0; back < ring.size() && row > top + 1u; ++back) {
+    Message& message = ring[(next + ring.size() - 1 - back) % ring.size()];
+    if(message.wrap_width != wrap_width) {
+      message.lines.clear();
+      break_line_spans(message.text.data(), message.text.length(),
+                       wrap_width, message.lines);
+      message.wrap_width = wrap_width;
+    }
+    for(auto it = message.lines.crbegin();
+        it != message.lines.crend() && row > top + 1u; ++it) {
+      --row;
+      put_row(colors + row * width, glyphs + row * width, width,
+              DEFAULT_LOOSE_TEXT_COLOR, message.text.data() + it->start,
+              it->length);
+    }
+  }
+  if(ring.empty() && row > top + 1u) {
+    --row;
+    put_row(colors + row * width, glyphs + row * width, width,
+            DEFAULT_LOOSE_TEXT_COLOR, EMPTY_TEXT, sizeof(EMPTY_TEXT)-1);
+  }
+  while(row > top + 1u) {
+    --row;
+    put_row(colors + row * width, glyphs + row * width, width,
+            DEFAULT_LOOSE_TEXT_COLOR, "", 0);
+  }
+  return top;
+}
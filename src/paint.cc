@@ -27,8 +27,10 @@
 
 #include <iostream>
 #include <chrono>
+#include <deque>
 
 #include "paint_framebuffer.hh"
+#include "frm.hh"
 
 static const char* font_path = "VGA8x16.png";
 static const char* overlay_path = nullptr;
@@ -38,7 +40,11 @@ static enum class DisplayMode {
 } display_mode = DisplayMode::DEFAULT;
 static int chars_wide = 80, chars_high = 24, undo_depth = 100;
 
-static const int MIN_CHARS_HIGH = 30;
+static const int MIN_CHARS_HIGH = 32;
+// the most of the canvas shown at once; bigger canvases scroll
+static const int MAX_VIEW_WIDE = 160;
+static const int MAX_VIEW_HIGH = 50;
+static const int MAX_CANVAS_SIZE = 4096;
 
 static const int FOREGROUND_COLOR_Y = 1;
 static const int BACKGROUND_COLOR_Y = 3;
@@ -68,7 +74,6 @@ static const int PAINT_GLYPH = -1;
 static SDLSoft_Display* display = nullptr;
 static SDL_Texture* overlay = nullptr;
 static Framebuffer* canvas;
-static Framebuffer* undo_stack = nullptr;
 static int overlay_width, overlay_height;
 
 static uint8_t fgcolor = 15;
@@ -79,12 +84,42 @@ static bool overlay_on = true, overlay_pulsing = false,
 static int overlay_alpha = OVERLAY_STARTING_ALPHA;
 static std::chrono::steady_clock::time_point overlay_pulse_tick;
 
+// the part of the canvas on screen; view_x and view_y are the canvas cell
+// in its top left corner
+static int view_wide, view_high, view_x = 0, view_y = 0;
+// where the overlay goes, in pixels, relative to the whole canvas
+static int overlay_canvas_x, overlay_canvas_y,
+  overlay_canvas_w, overlay_canvas_h;
+
+// relative to the screen, not the canvas
 static int mouse_x_glyph = -1;
 static int mouse_y_glyph = -1;
 static int mouse_y_halfglyph = -1;
 static bool painting = false, unpainting = false;
+// middle-dragging the view around; where the mouse and the view were when
+// the drag started
+static bool panning = false;
+static int pan_mouse_x, pan_mouse_y, pan_view_x, pan_view_y;
 
-static int newest_undo = 0, oldest_undo = 0, cur_undo = 0, saved_undo = 0;
+/* The undo journal. Each stroke gets an entry listing every cell it touched,
+   along with what that cell held on the other side of the stroke: the old
+   contents while the stroke is applied, the new ones once it is undone.
+   Undoing or redoing an entry swaps those with the canvas. Entries before
+   `cur_undo` are applied, the rest have been undone; `cur_cell` is where
+   entry `cur_undo` starts in `undo_cells`. `saved_undo` is the value
+   `cur_undo` had when the canvas was saved, or -1 if that state is gone. */
+struct UndoCell {
+  uint32_t index;
+  uint8_t color, glyph;
+};
+static std::deque<UndoCell> undo_cells;
+static std::deque<size_t> undo_entry_sizes;
+static size_t cur_cell = 0;
+static int cur_undo = 0, saved_undo = 0;
+// true while painting adds to the newest entry; `cell_in_stroke` marks the
+// cells already in it, so each one is only recorded once
+static bool stroke_open = false;
+static std::vector<bool> cell_in_stroke;
 static bool undo_was_okay = false, redo_was_okay = false,
   canvas_was_unsaved = false, canvas_is_unsaved = false;
 
@@ -148,9 +183,9 @@ static int parse_command_line(int argc, char* argv[]) {
           char* endptr;
           errno = 0;
           long l = strtol(*argv, &endptr, 0);
-          if(errno != 0 || *endptr || endptr == *argv || l <= 0 || l > 254) {
+          if(errno != 0 || *endptr || endptr == *argv || l <= 0 || l > MAX_CANVAS_SIZE) {
             ++argv; --argc;
-            std::cerr << "Argument for -w must be in range 1 -- 254" << std::endl;
+            std::cerr << "Argument for -w must be in range 1 -- " << MAX_CANVAS_SIZE << std::endl;
             ret = 1;
             break;
           }
@@ -166,9 +201,9 @@ static int parse_command_line(int argc, char* argv[]) {
           char* endptr;
           errno = 0;
           long l = strtol(*argv, &endptr, 0);
-          if(errno != 0 || *endptr || endptr == *argv || l <= 0 || l > 254) {
+          if(errno != 0 || *endptr || endptr == *argv || l <= 0 || l > MAX_CANVAS_SIZE) {
             ++argv; --argc;
-            std::cerr << "Argument for -h must be in range 1 -- 254" << std::endl;
+            std::cerr << "Argument for -h must be in range 1 -- " << MAX_CANVAS_SIZE << std::endl;
             ret = 1;
             break;
           }
@@ -210,9 +245,7 @@ static int parse_command_line(int argc, char* argv[]) {
             break;
           }
           ++argv; --argc;
-          // undo_depth includes the current canvas
-          if(l != 0) undo_depth = l + 1;
-          else undo_depth = l;
+          undo_depth = l;
         } break;
         case 'v':
           std::cout << "Paint, from TTTPClient " TTTP_CLIENT_VERSION << std::endl;
@@ -270,34 +303,88 @@ static int parse_command_line(int argc, char* argv[]) {
   return ret;
 }
 
+static void close_stroke() {
+  if(!stroke_open) return;
+  for(size_t n = cur_cell - undo_entry_sizes.back(); n < cur_cell; ++n)
+    cell_in_stroke[undo_cells[n].index] = false;
+  stroke_open = false;
+}
+
+// call at the start of every stroke
 static void edit_canvas() {
   canvas_is_unsaved = true;
-  if(undo_depth > 0) {
-    int next_undo = cur_undo + 1;
-    if(next_undo >= undo_depth) next_undo -= undo_depth;
-    undo_stack[next_undo] = undo_stack[cur_undo];
-    cur_undo = next_undo;
-    newest_undo = cur_undo;
-    if(oldest_undo == newest_undo) {
-      if(oldest_undo == saved_undo) saved_undo = -1;
-      oldest_undo = oldest_undo + 1;
-      if(oldest_undo >= undo_depth) oldest_undo -= undo_depth;
-    }
-    canvas = undo_stack + next_undo;
+  if(undo_depth <= 0) return;
+  close_stroke();
+  // starting a new stroke forgets everything that could have been redone
+  undo_cells.resize(cur_cell);
+  undo_entry_sizes.resize(cur_undo);
+  if(saved_undo > cur_undo) saved_undo = -1;
+  if(undo_entry_sizes.size() >= size_t(undo_depth)) {
+    undo_cells.erase(undo_cells.begin(),
+                     undo_cells.begin() + undo_entry_sizes.front());
+    cur_cell -= undo_entry_sizes.front();
+    undo_entry_sizes.pop_front();
+    --cur_undo;
+    if(saved_undo >= 0) --saved_undo;
+  }
+  undo_entry_sizes.push_back(0);
+  ++cur_undo;
+  stroke_open = true;
+}
+
+// call before changing a cell of the canvas
+static void record_cell(int x, int y) {
+  if(!stroke_open) return;
+  uint32_t index = y * chars_wide + x;
+  if(cell_in_stroke[index]) return;
+  cell_in_stroke[index] = true;
+  undo_cells.push_back({index, *canvas->GetColorPointer(x, y),
+        *canvas->GetGlyphPointer(x, y)});
+  ++undo_entry_sizes.back();
+  ++cur_cell;
+}
+
+static void swap_undo_entry(size_t start, size_t size) {
+  for(size_t n = start; n < start + size; ++n) {
+    UndoCell& cell = undo_cells[n];
+    int x = cell.index % chars_wide, y = cell.index / chars_wide;
+    std::swap(cell.color, *canvas->GetColorPointer(x, y));
+    std::swap(cell.glyph, *canvas->GetGlyphPointer(x, y));
+    canvas->DirtyPoint(x, y);
   }
 }
 
+static void undo() {
+  if(cur_undo == 0) return;
+  close_stroke();
+  painting = unpainting = false;
+  --cur_undo;
+  cur_cell -= undo_entry_sizes[cur_undo];
+  swap_undo_entry(cur_cell, undo_entry_sizes[cur_undo]);
+  canvas_is_unsaved = cur_undo != saved_undo;
+}
+
+static void redo() {
+  if(size_t(cur_undo) == undo_entry_sizes.size()) return;
+  close_stroke();
+  painting = unpainting = false;
+  swap_undo_entry(cur_cell, undo_entry_sizes[cur_undo]);
+  cur_cell += undo_entry_sizes[cur_undo];
+  ++cur_undo;
+  canvas_is_unsaved = cur_undo != saved_undo;
+}
+
 static void paint_divider(Framebuffer& fb) {
-  uint8_t* cp = fb.GetColorPointer(chars_wide, 0);
-  uint8_t* gp = fb.GetGlyphPointer(chars_wide, 0);
+  uint8_t* cp = fb.GetColorPointer(view_wide, 0);
+  uint8_t* gp = fb.GetGlyphPointer(view_wide, 0);
   for(int y = 0; y < fb.GetHeight(); ++y) {
     *cp = DIVIDER_COLOR; *gp = DIVIDER_GLYPH;
     cp += fb.GetPitch(); gp += fb.GetPitch();
   }
-  if(chars_high < MIN_CHARS_HIGH) {
-    cp = fb.GetColorPointer(0, chars_high);
-    gp = fb.GetGlyphPointer(0, chars_high);
-    for(int x = 0; x < chars_wide; ++x) {
+  if(view_high < MIN_CHARS_HIGH) {
+    cp = fb.GetColorPointer(0, view_high);
+    gp = fb.GetGlyphPointer(0, view_high);
+    for(int x = 0; x < view_wide; ++x) {
       *cp++ = DIVIDER_COLOR; *gp++ = DIVIDER_GLYPH;
     }
   }
@@ -306,8 +393,8 @@ static void paint_divider(Framebuffer& fb) {
 static void paint_glyphs(Framebuffer& fb) {
   uint8_t c = 0;
   for(int y = 0; y < 16; ++y) {
-    uint8_t* cp = fb.GetColorPointer(chars_wide + 1, GLYPHS_Y+y);
-    uint8_t* gp = fb.GetGlyphPointer(chars_wide + 1, GLYPHS_Y+y);
+    uint8_t* cp = fb.GetColorPointer(view_wide + 1, GLYPHS_Y+y);
+    uint8_t* gp = fb.GetGlyphPointer(view_wide + 1, GLYPHS_Y+y);
     for(int x = 0; x < 16; ++x) {
       *cp++ = UNSELECTED_GLYPH_COLOR; *gp++ = c++;
     }
@@ -325,19 +412,19 @@ static void paint_colors(Framebuffer& fb, int x, int y) {
 
 static void poke_color_selection(Framebuffer& fb, int y, uint8_t color,
                                  uint8_t glyph) {
-  *fb.GetGlyphPointer(chars_wide+1+color, y) = glyph;
-  fb.DirtyPoint(chars_wide+1+color, y);
+  *fb.GetGlyphPointer(view_wide+1+color, y) = glyph;
+  fb.DirtyPoint(view_wide+1+color, y);
 }
 
 static void poke_ui_region_color(Framebuffer& fb, int y, uint8_t color) {
-  auto p = fb.GetColorPointer(chars_wide+1, y);
+  auto p = fb.GetColorPointer(view_wide+1, y);
   memset(p, color, 16);
-  fb.DirtyRect(chars_wide+1, y, 16, 1);
+  fb.DirtyRect(view_wide+1, y, 16, 1);
 }
 
 static void poke_glyph_selection(Framebuffer& fb, int selection,uint8_t color){
   if(selection >= 0) {
-    int x = chars_wide+1+(selection&15);
+    int x = view_wide+1+(selection&15);
     int y = GLYPHS_Y+(selection>>4);
     *fb.GetColorPointer(x, y) = color;
     fb.DirtyPoint(x, y);
@@ -350,24 +437,26 @@ static void poke_glyph_selection(Framebuffer& fb, int selection,uint8_t color){
 static void init_screen(Framebuffer& fb) {
   paint_divider(fb);
   paint_glyphs(fb);
-  paint_colors(fb, chars_wide+1, FOREGROUND_COLOR_Y);
-  paint_colors(fb, chars_wide+1, BACKGROUND_COLOR_Y);
-  fb.PrintStr(chars_wide + 1, FOREGROUND_COLOR_Y-1, TEXT_COLOR, "Foreground:");
-  fb.PrintStr(chars_wide + 1, BACKGROUND_COLOR_Y-1, TEXT_COLOR, "Background:");
-  fb.PrintStr(chars_wide + 1, GLYPHS_Y-1, TEXT_COLOR, "Glyph:");
-  fb.PrintStr(chars_wide + 2, GLYPHS_Y+16, UNSELECTED_GLYPH_COLOR,
+  paint_colors(fb, view_wide+1, FOREGROUND_COLOR_Y);
+  paint_colors(fb, view_wide+1, BACKGROUND_COLOR_Y);
+  fb.PrintStr(view_wide + 1, FOREGROUND_COLOR_Y-1, TEXT_COLOR, "Foreground:");
+  fb.PrintStr(view_wide + 1, BACKGROUND_COLOR_Y-1, TEXT_COLOR, "Background:");
+  fb.PrintStr(view_wide + 1, GLYPHS_Y-1, TEXT_COLOR, "Glyph:");
+  fb.PrintStr(view_wide + 2, GLYPHS_Y+16, UNSELECTED_GLYPH_COLOR,
               "pai[n]t");
-  fb.PrintStr(chars_wide + 1, KEYS_Y+0, DISABLED_COLOR, "S: save");
-  fb.PrintStr(chars_wide + 1, KEYS_Y+1, overlay_path != nullptr ? TEXT_COLOR
+  fb.PrintStr(view_wide + 1, KEYS_Y+0, DISABLED_COLOR, "S: save");
+  fb.PrintStr(view_wide + 1, KEYS_Y+1, overlay_path != nullptr ? TEXT_COLOR
               : DISABLED_COLOR, "P: pulse o-lay");
-  fb.PrintStr(chars_wide + 1, KEYS_Y+2, overlay_path != nullptr ? TEXT_COLOR
+  fb.PrintStr(view_wide + 1, KEYS_Y+2, overlay_path != nullptr ? TEXT_COLOR
               : DISABLED_COLOR, "O: toggle o-lay");
-  fb.PrintStr(chars_wide + 1, KEYS_Y+3, overlay_path != nullptr ? TEXT_COLOR
+  fb.PrintStr(view_wide + 1, KEYS_Y+3, overlay_path != nullptr ? TEXT_COLOR
               : DISABLED_COLOR, "0-9: o-lay alpha");
-  fb.PrintStr(chars_wide + 1, KEYS_Y+4, DISABLED_COLOR, "Z: undo");
-  fb.PrintStr(chars_wide + 1, KEYS_Y+5, DISABLED_COLOR, "Y: redo");
-  // if I don't display it, nobody will ever know that I planned it
-  //fb.PrintStr(chars_wide + 1, KEYS_Y+5, TEXT_COLOR, "F: fill");
+  fb.PrintStr(view_wide + 1, KEYS_Y+4, DISABLED_COLOR, "Z: undo");
+  fb.PrintStr(view_wide + 1, KEYS_Y+5, DISABLED_COLOR, "Y: redo");
+  fb.PrintStr(view_wide + 1, KEYS_Y+6, TEXT_COLOR, "F: fill");
+  fb.PrintStr(view_wide + 1, KEYS_Y+7, view_wide < chars_wide
+              || view_high < chars_high ? TEXT_COLOR : DISABLED_COLOR,
+              "arrows/MMB: pan");
   poke_color_selection(fb, FOREGROUND_COLOR_Y, fgcolor, SELECTED_COLOR_GLYPH);
   poke_color_selection(fb, BACKGROUND_COLOR_Y, bgcolor, SELECTED_COLOR_GLYPH);
   poke_glyph_selection(fb, selected_glyph, SELECTED_GLYPH_COLOR);
@@ -377,6 +466,7 @@ static void paint(int glyph, int x, int y, bool erasing) {
   if(x < 0 || x >= chars_wide || y < 0 || y >= chars_high*2) return;
   if(glyph == PAINT_GLYPH) {
     auto color = erasing ? bgcolor : fgcolor;
+    record_cell(x, y/2);
     uint8_t* cp = canvas->GetColorPointer(x, y/2);
     uint8_t* gp = canvas->GetGlyphPointer(x, y/2);
     if(*gp == 0) {
@@ -411,23 +501,31 @@ static void paint(int glyph, int x, int y, bool erasing) {
   }
   else {
     y /= 2;
+    record_cell(x, y);
     *canvas->GetColorPointer(x, y) = (fgcolor<<4)|bgcolor;
     *canvas->GetGlyphPointer(x, y) = erasing ? 0 : glyph;
     canvas->DirtyPoint(x,y);
   }
 }
 
+// strokes only reach the part of the canvas that can be seen
+static void paint_visible(int glyph, int x, int y, bool erasing) {
+  if(x < view_x || x >= view_x + view_wide || y < view_y * 2
+     || y >= (view_y + view_high) * 2) return;
+  paint(glyph, x, y, erasing);
+}
+
 static void paint_path(int glyph, int x, int y, int ex, int ey,
                        bool erasing) {
-  paint(glyph, x, y, erasing);
+  paint_visible(glyph, x, y, erasing);
   if(x == ex) {
     if(y == ey) return;
     if(ey < y) std::swap(y, ey);
-    do { paint(glyph, x, ++y, erasing); } while(y != ey);
+    do { paint_visible(glyph, x, ++y, erasing); } while(y != ey);
   }
   else if(y == ey) {
     if(ex < x) std::swap(x, ex);
-    do { paint(glyph, ++x, y, erasing); } while(x != ex);
+    do { paint_visible(glyph, ++x, y, erasing); } while(x != ex);
   }
   else {
     int dx = (ex-x);
@@ -443,7 +541,7 @@ static void paint_path(int glyph, int x, int y, int ex, int ey,
       while(x++ != ex) {
         r += n;
         if(r >= d) r -= d, y += yd;
-        paint(glyph, x, y, erasing);
+        paint_visible(glyph, x, y, erasing);
       }
     }
     else {
@@ -455,12 +553,86 @@ static void paint_path(int glyph, int x, int y, int ex, int ey,
       while(y++ != ey) {
         r += n;
         if(r >= d) r -= d, x += xd;
-        paint(glyph, x, y, erasing);
+        paint_visible(glyph, x, y, erasing);
       }
     }
   }
 }
 
+// the color of a half-cell pixel, as paint() lays them out; -1 if the cell
+// holds some other glyph, which a fill treats as a wall
+static int get_pixel(int x, int y) {
+  uint8_t color = *canvas->GetColorPointer(x, y/2);
+  switch(*canvas->GetGlyphPointer(x, y/2)) {
+  case 0: return color & 15;
+  case 0xDC: return (y&1) ? color >> 4 : color & 15;
+  default: return -1;
+  }
+}
+
+/* Fills the area of same-colored pixels around x,y with the foreground
+   color. Scanline fill: each seed fills its whole horizontal span, then
+   pushes one seed for each span of the target color above and below it. The
+   stack is explicit, so even a fill covering the whole canvas doesn't
+   recurse. */
+static void flood_fill(int x, int y) {
+  if(x < 0 || x >= chars_wide || y < 0 || y >= chars_high*2) return;
+  int target = get_pixel(x, y);
+  if(target < 0 || target == fgcolor) return;
+  std::vector<std::pair<int, int> > seeds;
+  seeds.emplace_back(x, y);
+  while(!seeds.empty()) {
+    x = seeds.back().first;
+    y = seeds.back().second;
+    seeds.pop_back();
+    if(get_pixel(x, y) != target) continue;
+    int left = x, right = x;
+    while(left > 0 && get_pixel(left-1, y) == target) --left;
+    while(right < chars_wide-1 && get_pixel(right+1, y) == target) ++right;
+    for(int fx = left; fx <= right; ++fx)
+      paint(PAINT_GLYPH, fx, y, false);
+    for(int ny = y-1; ny <= y+1; ny += 2) {
+      if(ny < 0 || ny >= chars_high*2) continue;
+      bool in_span = false;
+      for(int fx = left; fx <= right; ++fx) {
+        bool matches = get_pixel(fx, ny) == target;
+        if(matches && !in_span) seeds.emplace_back(fx, ny);
+        in_span = matches;
+      }
+    }
+  }
+}
+
+static bool mouse_in_view() {
+  return mouse_x_glyph >= 0 && mouse_x_glyph < view_wide
+    && mouse_y_glyph >= 0 && mouse_y_glyph < view_high;
+}
+
+static void position_overlay() {
+  int char_width = display->GetCharWidth();
+  int char_height = display->GetCharHeight();
+  display->SetOverlayRegion(overlay_canvas_x - view_x * char_width,
+                            overlay_canvas_y - view_y * char_height,
+                            overlay_canvas_w, overlay_canvas_h);
+  display->SetOverlayClip(0, 0, view_wide * char_width,
+                          view_high * char_height);
+}
+
+// scrolls so that canvas cell x,y is in the top left corner, or as close as
+// it can get
+static void set_view(int x, int y) {
+  if(x > chars_wide - view_wide) x = chars_wide - view_wide;
+  if(x < 0) x = 0;
+  if(y > chars_high - view_high) y = chars_high - view_high;
+  if(y < 0) y = 0;
+  if(x == view_x && y == view_y) return;
+  view_x = x;
+  view_y = y;
+  // only what is now on screen gets copied, however big the canvas is
+  canvas->DirtyRect(view_x, view_y, view_wide, view_high);
+  if(overlay != nullptr) position_overlay();
+}
+
 static void save(Framebuffer& fb) {
   if(save_path.size() == 0) {
     display->Pump(false);
@@ -515,10 +687,7 @@ static void save(Framebuffer& fb) {
     fb.DirtyWhole();
     return;
   }
-  fputc(chars_wide, f);
-  fputc(chars_high, f);
-  if(fwrite(canvas->GetBuffer(), 1, canvas->GetWidth()*canvas->GetHeight()*2,f)
-     != size_t(canvas->GetWidth()*canvas->GetHeight()*2)) {
+  if(!FRM::Save(f, *canvas)) {
     auto& _ = save_fb();
     Widgets::ModalInfo(*display, std::string("Couldn't write: ") + strerror(errno));
     restore_fb(_);
@@ -540,7 +709,7 @@ int teg_main(int argc, char* argv[]) {
     {
       bool load_failed = false, ignore_load_failure = false;
       std::string load_failed_why;
-      Framebuffer loaded;
+      canvas = new Framebuffer();
       if(save_path.size() > 0) {
         FILE* f = fopen(save_path.c_str(), "rb");
         if(f == nullptr) {
@@ -549,52 +718,31 @@ int teg_main(int argc, char* argv[]) {
           ignore_load_failure = errno == ENOENT;
         }
         else {
-          int wide = fgetc(f);
-          int high = fgetc(f);
-          if(wide == EOF || wide == 0 || high == EOF || high == 0) {
-            load_failed = true;
-            load_failed_why = "Not a valid FRM";
-          }
-          else if(wide == 255 || high == 255) {
-            load_failed = true;
-            load_failed_why = "FRM is too large";
-          }
+          // straight into the canvas, with no intermediate copy
+          if(!FRM::Load(f, *canvas, load_failed_why)) load_failed = true;
           else {
-            loaded.Resize(wide, high);
-            if(fread(loaded.GetBuffer(), 1, wide*high*2, f)
-               != size_t(wide*high*2)) {
-              load_failed = true;
-              load_failed_why = "Unexpected EOF";
-            }
-            else {
-              chars_wide = wide;
-              chars_high = high;
-            }
+            chars_wide = canvas->GetWidth();
+            chars_high = canvas->GetHeight();
           }
           fclose(f);
         }
       }
-      if(undo_depth > 0) {
-        undo_stack = new Framebuffer[undo_depth]();
-        for(int n = 0; n < undo_depth; ++n) undo_stack[n].Resize(chars_wide,
-                                                                 chars_high,
-                                                                 n != 0);
-        canvas = undo_stack + cur_undo;
-      }
-      else canvas = new Framebuffer(chars_wide, chars_high);
-      if(save_path.size() > 0 && !load_failed)
-        *canvas = loaded;
+      if(save_path.size() == 0 || load_failed)
+        canvas->Resize(chars_wide, chars_high);
+      cell_in_stroke.resize(chars_wide * chars_high);
+      view_wide = std::min(chars_wide, MAX_VIEW_WIDE);
+      view_high = std::min(chars_high, MAX_VIEW_HIGH);
+      Font font(font_path);
+      display = new SDLSoft_Display(font, "Paint from TTTPClient "
+                                    TTTP_CLIENT_VERSION,
+                                    display_mode == DisplayMode::ACCELERATED,
+                                    0);
       if(load_failed && !ignore_load_failure) {
         display->SetPalette(mac16);
         Widgets::ModalInfo(*display,
                            std::string("Unable to load the FRM file: ")
                            + load_failed_why);
       }
-      Font font(font_path);
-      display = new SDLSoft_Display(font, "Paint from TTTPClient "
-                                    TTTP_CLIENT_VERSION,
-                                    display_mode == DisplayMode::ACCELERATED,
-                                    0);
       SDL_RendererInfo info;
       SDL_version vers;
       SDL_GetRendererInfo(display->GetRenderer(), &info);
@@ -627,24 +775,33 @@ int teg_main(int argc, char* argv[]) {
         double yr = (double)target_height / overlay_height;
         if(xr > yr) {
           int scaled_width = overlay_width * target_height / overlay_height;
-          display->SetOverlayRegion((target_width-scaled_width)/2, 0,
-                                    scaled_width, target_height);
+          overlay_canvas_x = (target_width-scaled_width)/2;
+          overlay_canvas_y = 0;
+          overlay_canvas_w = scaled_width;
+          overlay_canvas_h = target_height;
         }
         else {
           int scaled_height = overlay_height * target_width / overlay_width;
-          display->SetOverlayRegion(0, (target_height-scaled_height)/2,
-                                    target_width, scaled_height);
+          overlay_canvas_x = 0;
+          overlay_canvas_y = (target_height-scaled_height)/2;
+          overlay_canvas_w = target_width;
+          overlay_canvas_h = scaled_height;
         }
       }
-      else
-        display->SetOverlayRegion(0, 0, target_width, target_height);
+      else {
+        overlay_canvas_x = 0;
+        overlay_canvas_y = 0;
+        overlay_canvas_w = target_width;
+        overlay_canvas_h = target_height;
+      }
+      position_overlay();
       SDL_SetTextureBlendMode(overlay, SDL_BLENDMODE_BLEND);
       if(SDL_SetTextureAlphaMod(overlay, OVERLAY_STARTING_ALPHA))
         throw std::string("Can't set alpha modulation with this renderer");
       display->SetOverlayTexture(overlay, overlay_width, overlay_height);
     }
     display->SetPalette(tttp_default_palette);
-    Framebuffer fb(chars_wide + 17, chars_high < MIN_CHARS_HIGH ? MIN_CHARS_HIGH : chars_high);
+    Framebuffer fb(view_wide + 17, view_high < MIN_CHARS_HIGH ? MIN_CHARS_HIGH : view_high);
     init_screen(fb);
     class LocalInputDelegate : public InputDelegate {
       Framebuffer& fb;
@@ -663,12 +820,12 @@ int teg_main(int argc, char* argv[]) {
         case KEY_0:
           // 255 breaks software renderer in 2.0.2
           SDL_SetTextureAlphaMod(overlay, 254);
-          if(overlay_on) fb.DirtyWhole();
+          if(overlay_on) display->DirtyOverlay();
           break;
         case KEY_1: case KEY_2: case KEY_3: case KEY_4: case KEY_5: case KEY_6:
         case KEY_7: case KEY_8: case KEY_9:
           SDL_SetTextureAlphaMod(overlay, (overlay_alpha = (scancode-KEY_0)*255/10));
-          if(overlay_on) fb.DirtyWhole();
+          if(overlay_on) display->DirtyOverlay();
           break;
         case KEY_O:
           if(overlay == nullptr) break;
@@ -680,13 +837,13 @@ int teg_main(int argc, char* argv[]) {
           }
           else
             display->SetOverlayTexture(nullptr, 0, 0);
-          fb.DirtyRect(0, 0, chars_wide, chars_high);
+          display->DirtyOverlay();
           break;
         case KEY_P:
           if(overlay == nullptr) break;
           if(overlay_pulsing) {
             overlay_pulsing = false;
-            fb.DirtyRect(0, 0, chars_wide, chars_high);
+            display->DirtyOverlay();
           }
           else {
             if(!overlay_on)
@@ -699,26 +856,48 @@ int teg_main(int argc, char* argv[]) {
           }
           break;
         case KEY_Z:
-          if(cur_undo != oldest_undo) {
-            cur_undo = cur_undo - 1;
-            if(cur_undo < 0) cur_undo += undo_depth;
-            canvas = undo_stack + cur_undo;
-            canvas->DirtyWhole();
-            canvas_is_unsaved = cur_undo != saved_undo;
-          }
+          undo();
           break;
         case KEY_Y:
-          if(cur_undo != newest_undo) {
-            cur_undo = cur_undo + 1;
-            if(cur_undo >= undo_depth) cur_undo -= undo_depth;
-            canvas = undo_stack + cur_undo;
-            canvas->DirtyWhole();
-            canvas_is_unsaved = cur_undo != saved_undo;
-          }
+          redo();
           break;
         case KEY_S:
           save(fb);
           break;
+        case KEY_F:
+          // a fill is its own stroke, so not in the middle of another one
+          if(painting || unpainting) break;
+          if(mouse_in_view()) {
+            edit_canvas();
+            flood_fill(view_x + mouse_x_glyph, view_y * 2 + mouse_y_halfglyph);
+          }
+          break;
+        // panning; not while a stroke is in progress, since it would draw a
+        // line across everything the view passed over
+        case KEY_LEFT:
+          if(!painting && !unpainting) set_view(view_x - 1, view_y);
+          break;
+        case KEY_RIGHT:
+          if(!painting && !unpainting) set_view(view_x + 1, view_y);
+          break;
+        case KEY_UP:
+          if(!painting && !unpainting) set_view(view_x, view_y - 1);
+          break;
+        case KEY_DOWN:
+          if(!painting && !unpainting) set_view(view_x, view_y + 1);
+          break;
+        case KEY_HOME:
+          if(!painting && !unpainting) set_view(view_x - view_wide, view_y);
+          break;
+        case KEY_END:
+          if(!painting && !unpainting) set_view(view_x + view_wide, view_y);
+          break;
+        case KEY_PAGE_UP:
+          if(!painting && !unpainting) set_view(view_x, view_y - view_high);
+          break;
+        case KEY_PAGE_DOWN:
+          if(!painting && !unpainting) set_view(view_x, view_y + view_high);
+          break;
         default: break;
         }
       }
@@ -726,13 +905,16 @@ int teg_main(int argc, char* argv[]) {
       void MouseMove(int16_t x, int16_t y) override {
         if(painting || unpainting)
           paint_path(selected_glyph,
-                     x / display->GetCharWidth(),
-                     y * 2 / display->GetCharHeight(),
-                     mouse_x_glyph, mouse_y_halfglyph,
+                     view_x + x / display->GetCharWidth(),
+                     view_y * 2 + y * 2 / display->GetCharHeight(),
+                     view_x + mouse_x_glyph, view_y * 2 + mouse_y_halfglyph,
                      unpainting);
         mouse_x_glyph = x / display->GetCharWidth();
         mouse_y_glyph = y / display->GetCharHeight();
         mouse_y_halfglyph = y * 2 / display->GetCharHeight();
+        if(panning)
+          set_view(pan_view_x - (mouse_x_glyph - pan_mouse_x),
+                   pan_view_y - (mouse_y_glyph - pan_mouse_y));
       }
       void MouseButton(int pressed, uint16_t button) override {
         if(painting) {
@@ -743,25 +925,29 @@ int teg_main(int argc, char* argv[]) {
           if(!pressed && button == TTTP_RIGHT_MOUSE_BUTTON)
             unpainting = false;
         }
+        else if(panning) {
+          if(!pressed && button == TTTP_MIDDLE_MOUSE_BUTTON)
+            panning = false;
+        }
         else if(pressed && button == TTTP_RIGHT_MOUSE_BUTTON) {
-          if(mouse_x_glyph >= 0 && mouse_x_glyph < chars_wide
-             && mouse_y_glyph >= 0 && mouse_y_glyph < chars_high) {
+          if(mouse_in_view()) {
             edit_canvas();
             unpainting = true;
-            paint(selected_glyph, mouse_x_glyph, mouse_y_halfglyph, true);
+            paint(selected_glyph, view_x + mouse_x_glyph,
+                  view_y * 2 + mouse_y_halfglyph, true);
           }
         }
         else if(pressed && button == TTTP_LEFT_MOUSE_BUTTON) {
-          if(mouse_x_glyph >= 0 && mouse_x_glyph < chars_wide
-             && mouse_y_glyph >= 0 && mouse_y_glyph < chars_high) {
+          if(mouse_in_view()) {
             edit_canvas();
             painting = true;
-            paint(selected_glyph, mouse_x_glyph, mouse_y_halfglyph, false);
+            paint(selected_glyph, view_x + mouse_x_glyph,
+                  view_y * 2 + mouse_y_halfglyph, false);
           }
-          else if(mouse_x_glyph >= chars_wide+1
+          else if(mouse_x_glyph >= view_wide+1
                   && mouse_x_glyph <= fb.GetWidth()
-                  && mouse_y_glyph >= 0 && mouse_y_glyph < chars_high) {
-            int x = mouse_x_glyph - chars_wide - 1;
+                  && mouse_y_glyph >= 0 && mouse_y_glyph < fb.GetHeight()) {
+            int x = mouse_x_glyph - view_wide - 1;
             int y = mouse_y_glyph;
             if(y == FOREGROUND_COLOR_Y) {
               uint8_t nu = x;
@@ -801,14 +987,24 @@ int teg_main(int argc, char* argv[]) {
           }
         }
         else if(pressed && button == TTTP_MIDDLE_MOUSE_BUTTON) {
-          /* TODO: try to paste from selection buffer */
+          if(mouse_in_view()) {
+            panning = true;
+            pan_mouse_x = mouse_x_glyph;
+            pan_mouse_y = mouse_y_glyph;
+            pan_view_x = view_x;
+            pan_view_y = view_y;
+          }
         }
       }
-      void Scroll(int8_t, int8_t) override {}
+      void Scroll(int8_t x, int8_t y) override {
+        // three cells per notch, up is positive
+        if(!painting && !unpainting && !panning)
+          set_view(view_x + x * 3, view_y - y * 3);
+      }
     } del(fb);
     display->SetInputDelegate(&del);
     while(1) {
-      canvas->Update(fb);
+      canvas->UpdateView(fb, view_x, view_y, view_wide, view_high);
       if(overlay_on && overlay_pulsing) {
         auto now = std::chrono::steady_clock::now();
         auto diff = std::chrono::duration_cast<std::chrono::microseconds>
@@ -825,15 +1021,17 @@ int teg_main(int argc, char* argv[]) {
           overlay_pulse_polarity = !overlay_pulse_polarity;
         }
         SDL_SetTextureAlphaMod(overlay, overlay_alpha);
-        fb.DirtyRect(0, 0, chars_wide, chars_high);
+        // the canvas itself hasn't changed, only how the overlay blends
+        // with it
+        display->DirtyOverlay();
       }
       if(canvas_is_unsaved != canvas_was_unsaved) {
         poke_ui_region_color(fb, KEYS_Y+0,
                              canvas_is_unsaved?TEXT_COLOR:DISABLED_COLOR);
         canvas_was_unsaved = canvas_is_unsaved;
       }
-      bool undo_is_okay = cur_undo != oldest_undo;
-      bool redo_is_okay = cur_undo != newest_undo;
+      bool undo_is_okay = cur_undo != 0;
+      bool redo_is_okay = size_t(cur_undo) != undo_entry_sizes.size();
       if(undo_is_okay != undo_was_okay) {
         poke_ui_region_color(fb, KEYS_Y+4,
                              undo_is_okay?TEXT_COLOR:DISABLED_COLOR);
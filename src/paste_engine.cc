@@ -0,0 +1,91 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "paste_engine.hh"
+#include "session.hh"
+#include "charconv.hh"
+
+PasteEngine::PasteEngine(Session& session)
+  : session(session), pos(0), active(false), showing_progress(false) {}
+
+void PasteEngine::Start(const char* text, size_t len) {
+  if(!active) {
+    tttp_client_begin_paste(session.GetClient());
+    this->text.clear();
+    pos = 0;
+    active = true;
+  }
+  this->text.append(text, len);
+}
+
+bool PasteEngine::Step() {
+  if(!active) return false;
+  tttp_client* tttp = session.GetClient();
+  for(int n = 0; n < MAX_CHUNKS_PER_STEP; ++n) {
+    if(Net::Select(nullptr, nullptr, nullptr, nullptr, &session.GetSockets(),
+                   nullptr, nullptr, 0).GetWritableSockStreams().empty())
+      break;
+    size_t end = std::min(text.length(), pos + CHUNK_SIZE);
+    // don't split a UTF-8 sequence across two chunks
+    while(end > pos && end < text.length() && (text[end] & 0xC0) == 0x80)
+      --end;
+    if(end == pos) end = std::min(text.length(), pos + CHUNK_SIZE);
+    uint8_t* chunk = reinterpret_cast<uint8_t*>(&text[pos]);
+    controls.clear();
+    // overwrite the buffer as we go, it's okay, CP437 is shorter than UTF-8
+    uint8_t* chunk_end = convert_utf8_to_cp437(chunk, chunk, end - pos,
+                                               &controls);
+    for_each_cp437_span(chunk, chunk_end, controls,
+                        [tttp](uint8_t* run, size_t runlen) {
+                          tttp_client_send_text(tttp, run, runlen);
+                        },
+                        [tttp](tttp_scancode code) {
+                          if(code == KEY_ENTER || code == KEY_TAB) {
+                            tttp_client_send_key(tttp, TTTP_PRESS, code);
+                            tttp_client_send_key(tttp, TTTP_RELEASE, code);
+                          }
+                        });
+    pos = end;
+    if(pos >= text.length()) {
+      Finish();
+      return false;
+    }
+  }
+  session.GetDisplay().Statusf("Pasting... %u%% (Escape to cancel)",
+                               (unsigned)((uint64_t)pos * 100
+                                          / text.length()));
+  showing_progress = true;
+  return true;
+}
+
+void PasteEngine::Cancel() {
+  if(active) Finish();
+}
+
+void PasteEngine::Abandon() {
+  if(showing_progress) session.GetDisplay().Statusf("");
+  showing_progress = false;
+  active = false;
+  text.clear();
+  text.shrink_to_fit();
+  controls.clear();
+}
+
+void PasteEngine::Finish() {
+  tttp_client_end_paste(session.GetClient());
+  Abandon();
+}
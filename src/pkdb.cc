@@ -18,9 +18,22 @@
 #include "pkdb.hh"
 #include "widgets.hh"
 #include "io.hh"
+#include "threads.hh"
 
 #include "sqlite3.h"
 
+#include <algorithm>
+#include <iostream>
+
+#if __WIN32__
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/vfs.h>
+#else
+#include <sys/param.h>
+#include <sys/mount.h>
+#endif
+
 static sqlite3* sqlite;
 static const char* PKDB_FILENAME = "Host Database.sqlite";
 
@@ -54,6 +67,12 @@ public:
     else
       return false;
   }
+  bool BindInt64(int i, int64_t value) {
+    if(stmt)
+      return sqlite3_bind_int64(stmt, i, value) == SQLITE_OK;
+    else
+      return false;
+  }
   // returns false on error
   bool Step() {
     if(owari) return true;
@@ -83,6 +102,9 @@ public:
     out = std::string(reinterpret_cast<const char*>(text), bytes);
     return true;
   }
+  int64_t GetInt64(int column) {
+    return sqlite3_column_int64(stmt, column);
+  }
   bool IsFinished() const { return stmt && owari; }
   // returns true on success, false on failure
   bool Finish() {
@@ -101,15 +123,301 @@ static PreparedStatement
   maybe_create_table("CREATE TABLE IF NOT EXISTS hosts"
                      " (host TEXT PRIMARY KEY NOT NULL,"
                      " public_key BLOB NOT NULL);"),
-  exclusive_lock("PRAGMA locking_mode = EXCLUSIVE;"),
-  get_public_key("SELECT public_key FROM hosts WHERE host = ?1 LIMIT 1;"),
-  change_public_key("UPDATE hosts SET public_key = ?2 WHERE host = ?1;"),
-  add_public_key("INSERT INTO hosts(host, public_key) VALUES (?1, ?2);"),
-  wipe_public_key("DELETE FROM hosts WHERE host = ?1;");
+  /* WAL lets other clients read (and write) the database while we have it
+     open, but it needs shared memory that only works between processes on
+     the same machine, and SQLite does not support it on network
+     filesystems, which is where shared home directories usually live. There
+     we stay with (or go back to) the rollback journal and rely on
+     busy_timeout. Either pragma answers with the mode actually in effect. */
+  wal_mode("PRAGMA journal_mode = WAL;"),
+  rollback_mode("PRAGMA journal_mode = DELETE;"),
+  load_public_keys("SELECT host, public_key FROM hosts;"),
+  put_public_key("INSERT OR REPLACE INTO hosts(host, public_key)"
+                 " VALUES (?1, ?2);"),
+  wipe_public_key("DELETE FROM hosts WHERE host = ?1;"),
+  begin_transaction("BEGIN IMMEDIATE;"),
+  commit_transaction("COMMIT;"),
+  rollback_transaction("ROLLBACK;");
 
-bool PKDB::Init(Display&, std::string& whynot) {
+namespace {
+  /* Every host key on file, loaded in one go by Init. Open addressing with
+     linear probing; a removed entry leaves a tombstone behind until the next
+     time the table grows. */
+  class HostKeyMap {
+    enum class SlotState : uint8_t { EMPTY, FULL, REMOVED };
+    struct Slot {
+      SlotState state = SlotState::EMPTY;
+      std::string host;
+      uint8_t public_key[TTTP_PUBLIC_KEY_LENGTH];
+    };
+    std::vector<Slot> slots;
+    // `used` counts tombstones too, since they lengthen probes just the same
+    size_t count = 0, used = 0;
+    static size_t Hash(const std::string& host) {
+      // FNV-1a
+      uint32_t hash = 2166136261U;
+      for(char c : host) {
+        hash ^= uint8_t(c);
+        hash *= 16777619U;
+      }
+      return hash;
+    }
+    // the index of the slot holding `host`, or else of the first free slot
+    // that could
+    size_t Probe(const std::string& host) const {
+      size_t mask = slots.size() - 1;
+      size_t free_slot = slots.size();
+      for(size_t i = Hash(host) & mask; ; i = (i + 1) & mask) {
+        const Slot& slot = slots[i];
+        switch(slot.state) {
+        case SlotState::EMPTY:
+          return free_slot != slots.size() ? free_slot : i;
+        case SlotState::REMOVED:
+          if(free_slot == slots.size()) free_slot = i;
+          break;
+        case SlotState::FULL:
+          if(slot.host == host) return i;
+          break;
+        }
+      }
+    }
+    // keeps the table at most half full, tombstones included
+    void Reserve(size_t needed) {
+      if(!slots.empty() && needed * 2 <= slots.size()) return;
+      size_t new_size = 64;
+      while(new_size < count * 4 || new_size < needed * 2) new_size *= 2;
+      std::vector<Slot> old_slots(new_size);
+      old_slots.swap(slots);
+      used = count;
+      for(auto& old : old_slots) {
+        if(old.state != SlotState::FULL) continue;
+        Slot& slot = slots[Probe(old.host)];
+        slot.state = SlotState::FULL;
+        slot.host = std::move(old.host);
+        memcpy(slot.public_key, old.public_key, TTTP_PUBLIC_KEY_LENGTH);
+      }
+    }
+  public:
+    size_t Count() const { return count; }
+    const uint8_t* Get(const std::string& host) const {
+      if(slots.empty()) return nullptr;
+      const Slot& slot = slots[Probe(host)];
+      return slot.state == SlotState::FULL ? slot.public_key : nullptr;
+    }
+    void Put(const std::string& host,
+             const uint8_t public_key[TTTP_PUBLIC_KEY_LENGTH]) {
+      Reserve(used + 1);
+      Slot& slot = slots[Probe(host)];
+      if(slot.state != SlotState::FULL) {
+        if(slot.state == SlotState::EMPTY) ++used;
+        slot.state = SlotState::FULL;
+        slot.host = host;
+        ++count;
+      }
+      memcpy(slot.public_key, public_key, TTTP_PUBLIC_KEY_LENGTH);
+    }
+    // false: there was nothing to remove
+    bool Remove(const std::string& host) {
+      if(slots.empty()) return false;
+      Slot& slot = slots[Probe(host)];
+      if(slot.state != SlotState::FULL) return false;
+      slot.state = SlotState::REMOVED;
+      slot.host.clear();
+      --count;
+      return true;
+    }
+    void Clear() {
+      slots.clear();
+      count = used = 0;
+    }
+    template<class F> void ForEach(F f) const {
+      for(auto& slot : slots)
+        if(slot.state == SlotState::FULL) f(slot.host);
+    }
+  };
+  HostKeyMap host_keys;
+  bool initialized = false;
+  // StartInit's thread, and what it came up with; nothing else in PKDB may
+  // be touched until it has been joined
+  std::thread init_thread;
+  bool init_result;
+  std::string init_whynot;
+  // every host name in host_keys, in order; rebuilt on demand after a host
+  // is added or removed
+  std::vector<std::string> sorted_hosts;
+  bool sorted_hosts_stale = true;
+  /* Changes made since Init, waiting to be written to the database by the
+     writer thread. An empty `public_key` means the host was wiped. Once Init
+     returns, only the writer thread touches `sqlite`. */
+  struct PendingWrite {
+    std::string host;
+    std::vector<uint8_t> public_key;
+  };
+  std::vector<PendingWrite> pending_writes;
+  std::string write_error;
+  bool writer_stopping = false;
+  std::mutex writer_mutex;
+  std::condition_variable writer_cond;
+  std::thread writer;
+  // false: SQLite failed somewhere, and nothing in `batch` was written
+  bool write_batch(const std::vector<PendingWrite>& batch) {
+    if(!begin_transaction.Prepare()) return false;
+    begin_transaction.Reset();
+    if(!begin_transaction.Finish()) return false;
+    for(auto& write : batch) {
+      PreparedStatement& stmt = write.public_key.empty() ? wipe_public_key
+        : put_public_key;
+      if(!stmt.Prepare()) goto err;
+      stmt.Reset();
+      if(!stmt.BindText(1, write.host)) goto err;
+      if(!write.public_key.empty()
+         && !stmt.BindBlob(2, write.public_key.data(),
+                           write.public_key.size()))
+        goto err;
+      if(!stmt.Finish()) goto err;
+    }
+    if(!commit_transaction.Prepare()) goto err;
+    commit_transaction.Reset();
+    if(!commit_transaction.Finish()) goto err;
+    return true;
+  err:
+    if(rollback_transaction.Prepare()) {
+      rollback_transaction.Reset();
+      rollback_transaction.Finish();
+    }
+    return false;
+  }
+  void writer_thread() {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    while(true) {
+      writer_cond.wait(lock, []{
+          return writer_stopping || !pending_writes.empty(); });
+      if(pending_writes.empty()) break;
+      std::vector<PendingWrite> batch;
+      batch.swap(pending_writes);
+      lock.unlock();
+      bool ok = write_batch(batch);
+      lock.lock();
+      if(!ok && write_error.empty())
+        write_error = sqlite3_errmsg(sqlite);
+    }
+  }
+  // waits for everything queued so far to be written; afterward, the caller
+  // has `sqlite` to itself until the next queue_write
+  void stop_writer() {
+    {
+      std::lock_guard<std::mutex> lock(writer_mutex);
+      writer_stopping = true;
+    }
+    writer_cond.notify_one();
+    if(writer.joinable()) writer.join();
+    writer_stopping = false;
+  }
+  // the in-memory copy has already been changed; this just arranges for the
+  // database to catch up
+  void queue_write(const std::string& canon_name,
+                   const uint8_t* public_key, const char* what) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    if(!write_error.empty())
+      die("%s failed. The database is probably corrupted.\n\n%s", what,
+          write_error.c_str());
+    pending_writes.push_back({canon_name, public_key
+          ? std::vector<uint8_t>(public_key,
+                                 public_key + TTTP_PUBLIC_KEY_LENGTH)
+          : std::vector<uint8_t>()});
+    if(!writer.joinable()) writer = std::thread(writer_thread);
+    writer_cond.notify_one();
+  }
+  const std::vector<std::string>& get_sorted_hosts() {
+    if(sorted_hosts_stale) {
+      sorted_hosts.clear();
+      sorted_hosts.reserve(host_keys.Count());
+      host_keys.ForEach([](const std::string& host) {
+          sorted_hosts.push_back(host);
+        });
+      std::sort(sorted_hosts.begin(), sorted_hosts.end());
+      sorted_hosts_stale = false;
+    }
+    return sorted_hosts;
+  }
+}
+
+// every name starting with `prefix` sorts between `prefix` and this; canonical
+// names are always ASCII, so none of them contain a 0xFF byte
+static std::string prefix_end(const std::string& prefix) {
+  return prefix + '\xFF';
+}
+
+// the part of Fini that is safe to do from StartInit's thread: neither
+// thread is joined, so the caller must already have the database to itself
+static void close_database() {
+  maybe_create_table.Finalize();
+  load_public_keys.Finalize();
+  put_public_key.Finalize();
+  wipe_public_key.Finalize();
+  begin_transaction.Finalize();
+  commit_transaction.Finalize();
+  rollback_transaction.Finalize();
+  sqlite3_close(sqlite);
+  sqlite = nullptr;
+  sqlite3_shutdown();
+  host_keys.Clear();
+  sorted_hosts.clear();
+  sorted_hosts_stale = true;
+  initialized = false;
+}
+
+// best effort; false if we can't tell
+static bool on_network_filesystem(const char* path) {
+#if __WIN32__
+  // UNC path
+  if((path[0] == '\\' || path[0] == '/')
+     && (path[1] == '\\' || path[1] == '/'))
+    return true;
+  if(path[0] == 0 || path[1] != ':') return false;
+  char root[4] = {path[0], ':', '\\', 0};
+  return GetDriveTypeA(root) == DRIVE_REMOTE;
+#elif defined(__linux__)
+  struct statfs buf;
+  if(statfs(path, &buf)) return false;
+  switch((uint32_t)buf.f_type) {
+  case 0x6969: // NFS
+  case 0x517B: // SMB
+  case 0xFF534D42: // CIFS
+  case 0xFE534D42: // SMB2
+  case 0x5346414F: // AFS
+  case 0x73757245: // Coda
+  case 0x01021997: // 9P
+  case 0x47504653: // GPFS
+  case 0x0BD00BD0: // Lustre
+  case 0x00C36400: // Ceph
+    return true;
+  default:
+    return false;
+  }
+#elif defined(MNT_LOCAL)
+  struct statfs buf;
+  if(statfs(path, &buf)) return false;
+  return !(buf.f_flags & MNT_LOCAL);
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+// returns the journal mode SQLite reports after `stmt`, or "" on failure
+static std::string set_journal_mode(PreparedStatement& stmt) {
+  std::string mode;
+  if(stmt.Prepare() && stmt.Step() && !stmt.IsFinished())
+    stmt.GetString(0, mode);
+  stmt.Finalize();
+  return mode;
+}
+
+static bool open_database(std::string& whynot) {
   const char* dbpath = IO::GetConfigFilePath(PKDB_FILENAME);
-  sqlite3_config(SQLITE_CONFIG_SINGLETHREAD);
+  // the connection is handed over to the writer thread once Init is done
+  sqlite3_config(SQLITE_CONFIG_MULTITHREAD);
   int res = sqlite3_open(dbpath, &sqlite);
   if(res == SQLITE_CANTOPEN) {
     if(sqlite) sqlite3_close(sqlite);
@@ -119,79 +427,226 @@ bool PKDB::Init(Display&, std::string& whynot) {
   if(res != SQLITE_OK) {
     whynot = sqlite3_errmsg(sqlite);
     if(sqlite) sqlite3_close(sqlite);
+    sqlite = nullptr;
     sqlite3_shutdown();
     safe_free(const_cast<char*>(dbpath));
     return false;
   }
-  exclusive_lock.Prepare() && exclusive_lock.Finish();
-  exclusive_lock.Finalize();
+  // if another client is in the middle of writing, wait for it a while
+  // instead of failing outright
+  sqlite3_busy_timeout(sqlite, 5000);
+  {
+    bool network = on_network_filesystem(dbpath);
+    std::string mode = set_journal_mode(network ? rollback_mode : wal_mode);
+    // an earlier version may have left the file in WAL mode, and it can only
+    // be switched back while no other client has it open
+    if(network && mode == "wal")
+      std::cerr << "The public key database is on a network filesystem, but"
+        " is still in WAL mode because another client has it open."
+                << std::endl;
+    // if WAL was refused locally, the rollback journal and busy_timeout
+    // still keep clients from trampling each other, just less politely
+  }
+  initialized = true;
+  host_keys.Clear();
+  sorted_hosts_stale = true;
+  write_error.clear();
+  uint8_t public_key[TTTP_PUBLIC_KEY_LENGTH];
+  std::string host;
   if(!maybe_create_table.Prepare() || !maybe_create_table.Finish()
-     || !get_public_key.Prepare()) {
-    whynot = std::string("The public key database seems to be corrupted. You might try deleting the database. Its location:\n\n")+dbpath;
-    safe_free(const_cast<char*>(dbpath));
-    PKDB::Fini();
-    return false;
+     || !load_public_keys.Prepare())
+    goto corrupt;
+  while(true) {
+    if(!load_public_keys.Step()) goto corrupt;
+    if(load_public_keys.IsFinished()) break;
+    // a key of the wrong size is as good as no key at all
+    if(load_public_keys.GetString(0, host)
+       && load_public_keys.GetBlob(1, public_key, TTTP_PUBLIC_KEY_LENGTH))
+      host_keys.Put(host, public_key);
   }
+  load_public_keys.Finalize();
+  maybe_create_table.Finalize();
   safe_free(const_cast<char*>(dbpath));
   return true;
+ corrupt:
+  whynot = std::string("The public key database seems to be corrupted. You might try deleting the database. Its location:\n\n")+dbpath;
+  safe_free(const_cast<char*>(dbpath));
+  // we may be on init_thread, which PKDB::Fini would try to join
+  close_database();
+  return false;
+}
+
+// false: StartInit's thread failed, and `whynot` says why; true if it was
+// never started
+static bool finish_init(std::string& whynot) {
+  if(!init_thread.joinable()) return true;
+  init_thread.join();
+  if(!init_result) whynot = init_whynot;
+  return init_result;
+}
+
+void PKDB::StartInit() {
+  if(initialized || init_thread.joinable()) return;
+  init_thread = std::thread([]() {
+      init_result = open_database(init_whynot);
+    });
+}
+
+bool PKDB::Init(Display&, std::string& whynot) {
+  if(init_thread.joinable()) return finish_init(whynot);
+  return initialized || open_database(whynot);
 }
 
 void PKDB::Fini() {
-  maybe_create_table.Finalize();
-  get_public_key.Finalize();
-  change_public_key.Finalize();
-  add_public_key.Finalize();
-  wipe_public_key.Finalize();
-  sqlite3_close(sqlite);
-  sqlite3_shutdown();
+  std::string whynot;
+  finish_init(whynot);
+  if(!initialized) return;
+  stop_writer();
+  // too late to do anything about it but mention it
+  if(!write_error.empty())
+    std::cerr << "Some changes to the public key database were not saved: "
+              << write_error << std::endl;
+  close_database();
 }
 
 bool PKDB::GetPublicKey(const std::string& canon_name,
                         uint8_t public_key[TTTP_PUBLIC_KEY_LENGTH]) {
-  if(!get_public_key.Prepare()) return false;
-  get_public_key.Reset();
-  if(!get_public_key.BindText(1, canon_name)) return false;
-  if(!get_public_key.Step()) return false;
-  if(get_public_key.IsFinished()) return false;
-  if(!get_public_key.GetBlob(0, public_key, TTTP_PUBLIC_KEY_LENGTH))
-    return false;
-  get_public_key.Finish();
+  const uint8_t* filed = host_keys.Get(canon_name);
+  if(!filed) return false;
+  memcpy(public_key, filed, TTTP_PUBLIC_KEY_LENGTH);
   return true;
 }
 
 void PKDB::ChangePublicKey(const std::string& canon_name,
                            const uint8_t public_key[TTTP_PUBLIC_KEY_LENGTH]) {
-  if(!change_public_key.Prepare()) goto err;
-  change_public_key.Reset();
-  if(!change_public_key.BindText(1, canon_name)) goto err;
-  if(!change_public_key.BindBlob(2, public_key, TTTP_PUBLIC_KEY_LENGTH))
-    goto err;
-  if(!change_public_key.Finish()) goto err;
-  return;
- err:
-  die("Updating the public key in the database failed. The database is probably corrupted.");
+  host_keys.Put(canon_name, public_key);
+  queue_write(canon_name, public_key, "Updating the public key in the database");
 }
 
 void PKDB::AddPublicKey(const std::string& canon_name,
                         const uint8_t public_key[TTTP_PUBLIC_KEY_LENGTH]) {
-  if(!add_public_key.Prepare()) goto err;
-  add_public_key.Reset();
-  if(!add_public_key.BindText(1, canon_name)) goto err;
-  if(!add_public_key.BindBlob(2, public_key, TTTP_PUBLIC_KEY_LENGTH))
-    goto err;
-  if(!add_public_key.Finish()) goto err;
-  return;
- err:
-  die("Adding the public key to the database failed. The database is probably corrupted.");
+  host_keys.Put(canon_name, public_key);
+  sorted_hosts_stale = true;
+  queue_write(canon_name, public_key, "Adding the public key to the database");
 }
 
 void PKDB::WipePublicKey(const std::string& canon_name) {
-  if(!wipe_public_key.Prepare()) goto err;
-  wipe_public_key.Reset();
-  if(!wipe_public_key.BindText(1, canon_name)) goto err;
-  if(!wipe_public_key.Finish()) goto err;
-  return;
+  if(host_keys.Remove(canon_name)) sorted_hosts_stale = true;
+  queue_write(canon_name, nullptr, "Removing public keys from the database");
+}
+
+size_t PKDB::CountHosts(const std::string& prefix) {
+  auto& hosts = get_sorted_hosts();
+  return std::lower_bound(hosts.begin(), hosts.end(), prefix_end(prefix))
+    - std::lower_bound(hosts.begin(), hosts.end(), prefix);
+}
+
+bool PKDB::ListHosts(const std::string& prefix, size_t offset, size_t count,
+                     std::vector<std::string>& out) {
+  out.clear();
+  if(!initialized) return false;
+  auto& hosts = get_sorted_hosts();
+  auto begin = std::lower_bound(hosts.begin(), hosts.end(), prefix);
+  auto end = std::lower_bound(begin, hosts.end(), prefix_end(prefix));
+  if(offset >= size_t(end - begin)) return true;
+  begin += offset;
+  if(count < size_t(end - begin)) end = begin + count;
+  out.assign(begin, end);
+  return true;
+}
+
+bool PKDB::Import(FILE* in, BulkStats& stats, std::string& whynot) {
+  stats = BulkStats();
+  if(!finish_init(whynot)) return false;
+  if(!initialized && !open_database(whynot)) return false;
+  stop_writer();
+  if(!begin_transaction.Prepare() || !put_public_key.Prepare()) goto err;
+  begin_transaction.Reset();
+  if(!begin_transaction.Finish()) goto err;
+  {
+    // canonical names and base64 keys are both far shorter than this, so a
+    // line that doesn't fit is bad anyway
+    char line[1024];
+    size_t line_number = 0;
+    uint8_t public_key[TTTP_PUBLIC_KEY_LENGTH];
+    while(fgets(line, sizeof(line), in)) {
+      ++line_number;
+      size_t len = strlen(line);
+      bool bad = false;
+      if(len == sizeof(line) - 1 && line[len-1] != '\n' && !feof(in)) {
+        int c;
+        while((c = getc(in)) != EOF && c != '\n') {}
+        bad = true;
+      }
+      char* p = line;
+      while(isspace(uint8_t(*p))) ++p;
+      if(!bad && (*p == 0 || *p == '#')) continue;
+      char* name = p;
+      while(*p && !isspace(uint8_t(*p))) ++p;
+      size_t name_len = p - name;
+      while(isspace(uint8_t(*p))) ++p;
+      char* key = p;
+      while(*p && !isspace(uint8_t(*p))) ++p;
+      char* key_end = p;
+      while(isspace(uint8_t(*p))) ++p;
+      if(!bad && (name_len == 0 || key == key_end || *p != 0)) bad = true;
+      if(!bad) {
+        *key_end = 0;
+        bad = !tttp_key_from_base64(key, public_key)
+          || tttp_key_is_null_public_key(public_key);
+      }
+      if(bad) {
+        if(stats.bad_lines++ == 0) stats.first_bad_line = line_number;
+        continue;
+      }
+      std::string host(name, name_len);
+      put_public_key.Reset();
+      if(!put_public_key.BindText(1, host)
+         || !put_public_key.BindBlob(2, public_key, TTTP_PUBLIC_KEY_LENGTH)
+         || !put_public_key.Finish())
+        goto err;
+      host_keys.Put(host, public_key);
+      ++stats.rows;
+    }
+  }
+  if(ferror(in)) {
+    whynot = "Could not read the host key file.";
+    goto rollback;
+  }
+  if(!commit_transaction.Prepare()) goto err;
+  commit_transaction.Reset();
+  if(!commit_transaction.Finish()) goto err;
+  sorted_hosts_stale = true;
+  return true;
  err:
-  die("Removing public keys from the database failed. The database is probably corrupted.");
+  whynot = sqlite3_errmsg(sqlite);
+ rollback:
+  if(rollback_transaction.Prepare()) {
+    rollback_transaction.Reset();
+    rollback_transaction.Finish();
+  }
+  // the in-memory copy has some of the file in it, and the database has none
+  // of it; the simplest way to make them agree again is to start over
+  PKDB::Fini();
+  return false;
 }
 
+bool PKDB::Export(FILE* out, BulkStats& stats, std::string& whynot) {
+  stats = BulkStats();
+  if(!finish_init(whynot)) return false;
+  if(!initialized && !open_database(whynot)) return false;
+  char base64[TTTP_KEY_BASE64_BUFFER_SIZE];
+  for(auto& host : get_sorted_hosts()) {
+    tttp_key_to_base64(host_keys.Get(host), base64);
+    if(fprintf(out, "%s %s\n", host.c_str(), base64) < 0) {
+      whynot = "Could not write the host key file.";
+      return false;
+    }
+    ++stats.rows;
+  }
+  if(fflush(out)) {
+    whynot = "Could not write the host key file.";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,234 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recording.hh"
+#include "display.hh"
+#include "io.hh"
+
+#include <chrono>
+#include <vector>
+#include <errno.h>
+
+/* File format: the magic "TTR1", then a sequence of events. Each event is a
+   type byte, then the number of microseconds since the previous event as a
+   little-endian u32 (saturating), then a payload:
+   'P': 48 bytes of palette
+   'F': u16 width, height, dirty left, top, width, height; then the dirty
+        rectangle's colors, row by row, then its glyphs, row by row
+   'T': u32 length, then that many bytes of text */
+
+static const uint8_t RECORDING_MAGIC[4] = {'T','T','R','1'};
+
+typedef std::chrono::steady_clock recording_clock;
+
+static FILE* record_file = nullptr;
+static recording_clock::time_point last_event;
+static std::vector<uint8_t> record_buf;
+
+static void put_le(std::vector<uint8_t>& buf, uint32_t in, int bytes) {
+  for(int n = 0; n < bytes; ++n) {
+    buf.push_back((uint8_t)in);
+    in >>= 8;
+  }
+}
+
+static void begin_event(uint8_t type) {
+  auto now = recording_clock::now();
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>
+    (now - last_event).count();
+  last_event = now;
+  record_buf.clear();
+  record_buf.push_back(type);
+  put_le(record_buf, us > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)us, 4);
+}
+
+static void end_event() {
+  if(fwrite(record_buf.data(), 1, record_buf.size(), record_file)
+     != record_buf.size()) {
+    fclose(record_file);
+    record_file = nullptr;
+    die("Error writing the session recording");
+  }
+}
+
+void Recording::Start(const char* path) {
+  Stop();
+  record_file = fopen(path, "wb");
+  if(!record_file)
+    throw std::string("Opening ") + path + ": " + strerror(errno);
+  // frames can be large; let stdio batch them into big writes
+  setvbuf(record_file, nullptr, _IOFBF, 1 << 20);
+  last_event = recording_clock::now();
+  record_buf.assign(RECORDING_MAGIC, RECORDING_MAGIC + 4);
+  end_event();
+}
+
+void Recording::Stop() {
+  if(record_file == nullptr) return;
+  fclose(record_file);
+  record_file = nullptr;
+  std::vector<uint8_t>().swap(record_buf);
+}
+
+bool Recording::Active() {
+  return record_file != nullptr;
+}
+
+void Recording::Palette(const uint8_t colors[48]) {
+  begin_event('P');
+  record_buf.insert(record_buf.end(), colors, colors + 48);
+  end_event();
+}
+
+void Recording::Frame(uint16_t width, uint16_t height,
+                      uint16_t dirty_left, uint16_t dirty_top,
+                      uint16_t dirty_width, uint16_t dirty_height,
+                      const uint8_t* framedata) {
+  begin_event('F');
+  put_le(record_buf, width, 2);
+  put_le(record_buf, height, 2);
+  put_le(record_buf, dirty_left, 2);
+  put_le(record_buf, dirty_top, 2);
+  put_le(record_buf, dirty_width, 2);
+  put_le(record_buf, dirty_height, 2);
+  for(int plane = 0; plane < 2; ++plane) {
+    const uint8_t* p = framedata + plane * size_t(width) * height
+      + size_t(dirty_top) * width + dirty_left;
+    for(uint16_t y = 0; y < dirty_height; ++y) {
+      record_buf.insert(record_buf.end(), p, p + dirty_width);
+      p += width;
+    }
+  }
+  end_event();
+}
+
+void Recording::Text(const uint8_t* data, size_t len) {
+  if(len > 0xFFFFFFFF) len = 0xFFFFFFFF;
+  begin_event('T');
+  put_le(record_buf, (uint32_t)len, 4);
+  record_buf.insert(record_buf.end(), data, data + len);
+  end_event();
+}
+
+namespace {
+  class ReplayReader {
+    FILE* f;
+    const char* path;
+  public:
+    ReplayReader(const char* path) : path(path) {
+      f = IO::OpenRawPathForRead(path);
+      if(!f) throw std::string("Opening ") + path + ": " + strerror(errno);
+    }
+    ~ReplayReader() { fclose(f); }
+    // false: clean end of file
+    bool ReadType(uint8_t& type) {
+      int c = fgetc(f);
+      if(c == EOF) return false;
+      type = (uint8_t)c;
+      return true;
+    }
+    void Read(void* buf, size_t len) {
+      if(fread(buf, 1, len, f) != len)
+        die("The session recording \"%s\" is truncated", path);
+    }
+    uint32_t ReadLE(int bytes) {
+      uint8_t buf[4];
+      Read(buf, bytes);
+      uint32_t ret = 0;
+      for(int n = bytes - 1; n >= 0; --n) ret = (ret << 8) | buf[n];
+      return ret;
+    }
+  };
+}
+
+Recording::ReplayStats Recording::Replay(Display& display, const char* path,
+                                         bool realtime,
+                                         void(*text_callback)(void*,
+                                                              const uint8_t*,
+                                                              size_t)) {
+  ReplayReader reader(path);
+  uint8_t magic[4];
+  reader.Read(magic, 4);
+  if(memcmp(magic, RECORDING_MAGIC, 4))
+    die("\"%s\" is not a session recording", path);
+  ReplayStats stats = {};
+  std::vector<uint8_t> frame, payload;
+  uint16_t frame_width = 0, frame_height = 0;
+  auto start = recording_clock::now();
+  auto due = start;
+  uint8_t type;
+  while(reader.ReadType(type)) {
+    due += std::chrono::microseconds(reader.ReadLE(4));
+    if(realtime) {
+      auto now = recording_clock::now();
+      while(now < due) {
+        int timeout_ms = (int)std::chrono::duration_cast
+          <std::chrono::milliseconds>(due - now).count();
+        if(timeout_ms <= 0) break; // (Pump would wait forever)
+        display.Pump(true, timeout_ms);
+        now = recording_clock::now();
+      }
+    }
+    switch(type) {
+    case 'P': {
+      uint8_t colors[48];
+      reader.Read(colors, 48);
+      display.SetPalette(colors);
+      ++stats.palettes;
+    } break;
+    case 'F': {
+      uint16_t width = reader.ReadLE(2), height = reader.ReadLE(2);
+      uint16_t dirty_left = reader.ReadLE(2), dirty_top = reader.ReadLE(2);
+      uint16_t dirty_width = reader.ReadLE(2), dirty_height = reader.ReadLE(2);
+      if(dirty_left + dirty_width > width || dirty_top + dirty_height > height)
+        die("The session recording \"%s\" is damaged", path);
+      if(width != frame_width || height != frame_height) {
+        frame_width = width;
+        frame_height = height;
+        frame.assign(size_t(width) * height * 2, 0);
+      }
+      payload.resize(size_t(dirty_width) * dirty_height * 2);
+      reader.Read(payload.data(), payload.size());
+      const uint8_t* src = payload.data();
+      for(int plane = 0; plane < 2; ++plane) {
+        uint8_t* dst = frame.data() + plane * size_t(width) * height
+          + size_t(dirty_top) * width + dirty_left;
+        for(uint16_t y = 0; y < dirty_height; ++y) {
+          memcpy(dst, src, dirty_width);
+          src += dirty_width;
+          dst += width;
+        }
+      }
+      display.Update(width, height, dirty_left, dirty_top,
+                     dirty_width, dirty_height, frame.data());
+      ++stats.frames;
+    } break;
+    case 'T': {
+      payload.resize(reader.ReadLE(4));
+      reader.Read(payload.data(), payload.size());
+      if(text_callback)
+        text_callback(&display, payload.data(), payload.size());
+      ++stats.texts;
+    } break;
+    default:
+      die("The session recording \"%s\" is damaged", path);
+    }
+  }
+  stats.seconds = std::chrono::duration<double>
+    (recording_clock::now() - start).count();
+  return stats;
+}
@@ -25,9 +25,104 @@
 # define Font UnConflictMe
 # define Display X11Display
 # include "SDL_syswm.h"
+# include <X11/Xatom.h>
+# include <X11/extensions/Xfixes.h>
 # undef Font
 # undef Display
 #include <vector>
+#include <climits>
+
+/* The PRIMARY selection, read over the X connection SDL already has. Reads
+   are asynchronous: we ask the owner to convert the selection into a property
+   on our window, and the answer (in pieces, for a big selection) arrives as
+   events, which Pump passes to HandleEvent. XFixes tells us whenever the
+   selection changes hands, so we throw out the old text and start reading
+   the new one right away; by the time of a middle click, it's usually already
+   here. */
+struct SDLSoft_Display::PrimarySelection {
+  X11Display* display;
+  Window window;
+  int xfixes_event_base;
+  Atom utf8_string, incr, property;
+  // the time of the request we're waiting on an answer to
+  Time request_time;
+  bool requesting, receiving_incr;
+  // valid when not `requesting`
+  std::vector<char> text;
+  PrimarySelection(X11Display* display, Window window, int xfixes_event_base)
+    : display(display), window(window), xfixes_event_base(xfixes_event_base),
+      utf8_string(XInternAtom(display, "UTF8_STRING", False)),
+      incr(XInternAtom(display, "INCR", False)),
+      property(XInternAtom(display, "TTTP_PRIMARY", False)),
+      requesting(false), receiving_incr(false) {
+    XFixesSelectSelectionInput(display, window, XA_PRIMARY,
+                               XFixesSetSelectionOwnerNotifyMask
+                               | XFixesSelectionWindowDestroyNotifyMask
+                               | XFixesSelectionClientCloseNotifyMask);
+    Request(CurrentTime);
+  }
+  void Request(Time when) {
+    text.clear();
+    receiving_incr = false;
+    if(XGetSelectionOwner(display, XA_PRIMARY) == None) {
+      requesting = false;
+      return;
+    }
+    XConvertSelection(display, XA_PRIMARY, utf8_string, property, window,
+                      when);
+    XFlush(display);
+    request_time = when;
+    requesting = true;
+  }
+  // appends the property's contents to `text` and deletes it; returns the
+  // number of bytes read, or -1 if the owner started an INCR transfer
+  long ReadProperty() {
+    Atom type;
+    int format;
+    unsigned long nitems, bytes_after;
+    unsigned char* data = nullptr;
+    if(XGetWindowProperty(display, window, property, 0, LONG_MAX / 4, True,
+                          AnyPropertyType, &type, &format, &nitems,
+                          &bytes_after, &data) != Success)
+      return 0;
+    long ret = 0;
+    if(type == incr) ret = -1;
+    else if(data && format == 8) {
+      text.insert(text.end(), data, data + nitems);
+      ret = nitems;
+    }
+    if(data) XFree(data);
+    return ret;
+  }
+  void HandleEvent(const XEvent& evt) {
+    if(evt.type == xfixes_event_base + XFixesSelectionNotify) {
+      auto& notify = reinterpret_cast<const XFixesSelectionNotifyEvent&>(evt);
+      if(notify.selection == XA_PRIMARY)
+        Request(notify.selection_timestamp);
+    }
+    else if(evt.type == SelectionNotify) {
+      if(!requesting || receiving_incr
+         || evt.xselection.requestor != window
+         || evt.xselection.selection != XA_PRIMARY
+         || evt.xselection.time != request_time)
+        return; // not ours, or an answer to a request we've given up on
+      if(evt.xselection.property == None) requesting = false; // refused
+      // deleting the INCR property tells the owner to start sending pieces
+      else if(ReadProperty() < 0) receiving_incr = true;
+      else requesting = false;
+    }
+    else if(evt.type == PropertyNotify) {
+      if(!receiving_incr || evt.xproperty.window != window
+         || evt.xproperty.atom != property
+         || evt.xproperty.state != PropertyNewValue)
+        return;
+      // an empty piece ends the transfer
+      if(ReadProperty() == 0) requesting = receiving_incr = false;
+    }
+  }
+};
+#else
+struct SDLSoft_Display::PrimarySelection {};
 #endif
 
 extern "C" const uint8_t blend_table[16*64*64];
@@ -63,15 +158,10 @@ void copy_out_glyph_data(uint32_t glyph_width, uint32_t glyph_height,
   }
 }
 
-SDLSoft_Display::SDLSoft_Display(Font& font, const char* title, bool accel,
-                                 float max_fps)
-  : Display(font.GetGlyphWidth(), font.GetGlyphHeight()),
-    throttle_framerate(false), status_dirty(false), exposed(false),
-    cur_width(0), cur_height(0), prev_status_len(0), renderer(NULL),
-    frametexture(NULL), overlaytexture(NULL) {
-  if(SDL_Init(SDL_INIT_VIDEO)) throw std::string(SDL_GetError());
-  glyphpitch = glyph_width * glyph_height;
-  if(glyphpitch / glyph_height != glyph_width)
+SDLSoft_GlyphData::SDLSoft_GlyphData(Font& font)
+  : glyph_width(font.GetGlyphWidth()), glyph_height(font.GetGlyphHeight()) {
+  pitch = glyph_width * glyph_height;
+  if(pitch / glyph_height != glyph_width)
     throw std::string("really improbable integer overflow");
   // has_alpha: A other than 1
   // has_color: in some pixel with A != 0, R != G or R != B
@@ -94,34 +184,70 @@ SDLSoft_Display::SDLSoft_Display(Font& font, const char* title, bool accel,
   uint32_t mult = 1;
   if(has_alpha) ++mult;
   if(has_color) mult += 2;
-  if(glyphpitch * mult * 256 / mult / 256 != glyphpitch)
+  if(pitch * mult * 256 / mult / 256 != pitch)
     throw std::string("really improbable integer overflow");
-  glyphpitch *= mult;
-  glyphdata = (uint8_t*)safe_malloc(glyphpitch * 256);
+  pitch *= mult;
+  data = (uint8_t*)safe_malloc(pitch * 256);
   if(has_alpha) {
     if(has_color)
       copy_out_glyph_data<true, true>(glyph_width, glyph_height,
-                                      glyphdata, font.GetRows());
+                                      data, font.GetRows());
     else
       copy_out_glyph_data<true, false>(glyph_width, glyph_height,
-                                       glyphdata, font.GetRows());
+                                       data, font.GetRows());
   }
   else {
     if(has_color)
       copy_out_glyph_data<false, true>(glyph_width, glyph_height,
-                                       glyphdata, font.GetRows());
+                                       data, font.GetRows());
     else
       copy_out_glyph_data<false, false>(glyph_width, glyph_height,
-                                        glyphdata, font.GetRows());
+                                        data, font.GetRows());
   }
+}
+
+SDLSoft_GlyphData::~SDLSoft_GlyphData() {
+  safe_free(data);
+}
+
+// several Sessions may each own a display, so SDL is only shut down when
+// the last one goes away
+static unsigned int sdl_users = 0;
+
+static void acquire_sdl() {
+  if(sdl_users == 0 && SDL_Init(SDL_INIT_VIDEO))
+    throw std::string(SDL_GetError());
+  ++sdl_users;
+}
+
+static void release_sdl() {
+  if(--sdl_users == 0) SDL_Quit();
+}
+
+SDLSoft_Display::SDLSoft_Display(Font& font, const char* title, bool accel,
+                                 float max_fps)
+  : SDLSoft_Display(std::make_shared<const SDLSoft_GlyphData>(font), title,
+                    accel, max_fps) {}
+
+SDLSoft_Display::SDLSoft_Display(std::shared_ptr<const SDLSoft_GlyphData>
+                                 glyphs, const char* title, bool accel,
+                                 float max_fps)
+  : Display(glyphs->GetGlyphWidth(), glyphs->GetGlyphHeight()),
+    throttle_framerate(false), status_dirty(false), exposed(false),
+    has_alpha(glyphs->HasAlpha()), has_color(glyphs->HasColor()),
+    glyphs(glyphs), glyphdata(glyphs->GetData()),
+    glyphpitch(glyphs->GetPitch()),
+    cur_width(0), cur_height(0), prev_status_len(0), pending_updates(0),
+    renderer(NULL),
+    frametexture(NULL), overlaytexture(NULL), overlay_clip_w(-1) {
+  acquire_sdl();
   // the connection dialogue is 80x9, save us having to resize the window
   window = SDL_CreateWindow(title,
                             SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
                             80 * glyph_width, 9 * glyph_height,
                             0);
   if(window == NULL) {
-    SDL_Quit();
-    safe_free(glyphdata);
+    release_sdl();
     throw std::string(SDL_GetError());
   }
   if(renderer == NULL && max_fps < 0) {
@@ -136,15 +262,13 @@ SDLSoft_Display::SDLSoft_Display(Font& font, const char* title, bool accel,
                                   : SDL_RENDERER_SOFTWARE);
   if(renderer == NULL) {
     SDL_DestroyWindow(window);
-    SDL_Quit();
-    safe_free(glyphdata);
+    release_sdl();
     throw std::string(SDL_GetError());
   }
   SDL_RendererInfo info;
   if(SDL_GetRendererInfo(renderer, &info)) {
     SDL_DestroyWindow(window);
-    SDL_Quit();
-    safe_free(glyphdata);
+    release_sdl();
     throw std::string(SDL_GetError());
   }
   if(max_fps < 0) {
@@ -178,8 +302,7 @@ SDLSoft_Display::SDLSoft_Display(Font& font, const char* title, bool accel,
   if(statustexture == NULL) {
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
-    SDL_Quit();
-    safe_free(glyphdata);
+    release_sdl();
     throw std::string(SDL_GetError());
   }
   if(max_fps > 0) {
@@ -188,14 +311,27 @@ SDLSoft_Display::SDLSoft_Display(Font& font, const char* title, bool accel,
     frame_interval = std::chrono::duration_cast<clock::duration>
       (std::chrono::duration<float>(1.f / max_fps));
   }
+#if defined(SDL_VIDEO_DRIVER_X11)
+  SDL_SysWMinfo wminfo;
+  SDL_VERSION(&wminfo.version);
+  int xfixes_event_base, xfixes_error_base;
+  if(SDL_GetWindowWMInfo(window, &wminfo)
+     && wminfo.subsystem == SDL_SYSWM_X11
+     && XFixesQueryExtension(wminfo.info.x11.display, &xfixes_event_base,
+                             &xfixes_error_base)) {
+    primary_selection.reset(new PrimarySelection(wminfo.info.x11.display,
+                                                 wminfo.info.x11.window,
+                                                 xfixes_event_base));
+    SDL_EventState(SDL_SYSWMEVENT, SDL_ENABLE);
+  }
+#endif
 }
 
 SDLSoft_Display::~SDLSoft_Display() {
   if(frametexture) SDL_DestroyTexture(frametexture);
   if(renderer) SDL_DestroyRenderer(renderer);
   if(window) SDL_DestroyWindow(window);
-  if(glyphdata) safe_free(glyphdata);
-  SDL_Quit();
+  release_sdl();
 }
 
 void SDLSoft_Display::StatusChanged() {
@@ -217,7 +353,7 @@ void SDLSoft_Display::SetPalette(const uint8_t palette[48]) {
 void SDLSoft_Display::DrawGlyph(uint8_t color, uint8_t glyph,
                                 uint8_t* outbase, uint32_t pitch,
                                 const uint8_t* palette) {
-  uint8_t* fontp = glyphdata + glyph * glyphpitch;
+  const uint8_t* fontp = glyphdata + glyph * glyphpitch;
   uint8_t bg = color&15;
   uint8_t bg_r = palette[bg*3];
   uint8_t bg_g = palette[bg*3+1];
@@ -254,7 +390,7 @@ void SDLSoft_Display::DrawGlyph(uint8_t color, uint8_t glyph,
 void SDLSoft_Display::DrawGlyphA(uint8_t color, uint8_t glyph,
                                  uint8_t* outbase, uint32_t pitch,
                                  const uint8_t* palette) {
-  uint8_t* fontp = glyphdata + glyph * glyphpitch;
+  const uint8_t* fontp = glyphdata + glyph * glyphpitch;
   uint8_t bg = color&15;
   uint8_t bg_r = palette[bg*3];
   uint8_t bg_g = palette[bg*3+1];
@@ -304,7 +440,7 @@ void SDLSoft_Display::DrawGlyphA(uint8_t color, uint8_t glyph,
 void SDLSoft_Display::DrawGlyphC(uint8_t color, uint8_t glyph,
                                  uint8_t* outbase, uint32_t pitch,
                                  const uint8_t* palette) {
-  uint8_t* fontp = glyphdata + glyph * glyphpitch;
+  const uint8_t* fontp = glyphdata + glyph * glyphpitch;
   uint8_t bg = color&15;
   uint8_t bg_r = palette[bg*3];
   uint8_t bg_g = palette[bg*3+1];
@@ -344,7 +480,7 @@ void SDLSoft_Display::DrawGlyphC(uint8_t color, uint8_t glyph,
 void SDLSoft_Display::DrawGlyphAC(uint8_t color, uint8_t glyph,
                                   uint8_t* outbase, uint32_t pitch,
                                   const uint8_t* palette) {
-  uint8_t* fontp = glyphdata + glyph * glyphpitch;
+  const uint8_t* fontp = glyphdata + glyph * glyphpitch;
   uint8_t bg = color&15;
   uint8_t bg_r = palette[bg*3];
   uint8_t bg_g = palette[bg*3+1];
@@ -481,6 +617,7 @@ void SDLSoft_Display::Update(uint16_t width, uint16_t height,
   if(dirty_right > this->dirty_right) this->dirty_right = dirty_right;
   if(dirty_top < this->dirty_top) this->dirty_top = dirty_top;
   if(dirty_bot > this->dirty_bot) this->dirty_bot = dirty_bot;
+  auto rasterize_start = std::chrono::steady_clock::now();
   UpdateTextureWithPixels(frametexture,
                           dirty_left, dirty_top,
                           dirty_right, dirty_bot,
@@ -488,6 +625,9 @@ void SDLSoft_Display::Update(uint16_t width, uint16_t height,
                           buffer + width * dirty_top + dirty_left,
                           buffer+(width*height)+width*dirty_top+dirty_left,
                           palette);
+  stats.rasterize_time += std::chrono::steady_clock::now() - rasterize_start;
+  ++stats.updates;
+  ++pending_updates;
   Pump();
 }
 
@@ -565,10 +705,13 @@ void SDLSoft_Display::Pump(bool wait, int timeout_ms) {
     if(count == 0)
       // we will wait until the next frame_interval passes
       next_frame += frame_interval;
-    else
+    else {
       // we have already passed the point at which the next frame should
-      // have rendered; "eat up" the missing frames
+      // have rendered; "eat up" the missing frames (if there was nothing to
+      // show, no present was skipped, we were just idle)
       next_frame += frame_interval * count;
+      if(need_present) stats.dropped += count;
+    }
   }
   if(need_present) {
     if(overlaytexture) {
@@ -580,6 +723,14 @@ void SDLSoft_Display::Pump(bool wait, int timeout_ms) {
       if(st < overlay_y) st = overlay_y;
       if(sr >= overlay_x+overlay_w) sr = overlay_x+overlay_w-1;
       if(sb >= overlay_y+overlay_h) sb = overlay_y+overlay_h-1;
+      if(overlay_clip_w >= 0) {
+        if(sl < overlay_clip_x) sl = overlay_clip_x;
+        if(st < overlay_clip_y) st = overlay_clip_y;
+        if(sr >= overlay_clip_x+overlay_clip_w)
+          sr = overlay_clip_x+overlay_clip_w-1;
+        if(sb >= overlay_clip_y+overlay_clip_h)
+          sb = overlay_clip_y+overlay_clip_h-1;
+      }
       if(sr>=sl && sb>=st) {
         SDL_Rect drect = {sl, st, sr-sl+1, sb-st+1};
         SDL_Rect usrect = {drect.x-overlay_x, drect.y-overlay_y,
@@ -595,6 +746,9 @@ void SDLSoft_Display::Pump(bool wait, int timeout_ms) {
       }
     }
     SDL_RenderPresent(renderer);
+    ++stats.presents;
+    if(pending_updates > 1) stats.coalesced += pending_updates - 1;
+    pending_updates = 0;
   }
   exposed = false;
   dirty_left = cur_width; dirty_top = cur_height;
@@ -654,21 +808,28 @@ void SDLSoft_Display::Pump(bool wait, int timeout_ms) {
       GetInputDelegate().Scroll(evt.wheel.x, evt.wheel.y);
       wait = false;
       break;
+#if defined(SDL_VIDEO_DRIVER_X11)
+    case SDL_SYSWMEVENT:
+      if(primary_selection && evt.syswm.msg->subsystem == SDL_SYSWM_X11)
+        primary_selection->HandleEvent(evt.syswm.msg->msg.x11.event);
+      break;
+#endif
     case SDL_TEXTINPUT:
       {
         uint8_t buf[sizeof(evt.text.text)+1];
+        std::vector<cp437_control> controls;
         uint8_t* outp = convert_utf8_to_cp437((const uint8_t*)evt.text.text,
                                               buf,
                                               strlen(evt.text.text),
-                                         [this](uint8_t* sofar,
-                                                size_t sofarlen,
-                                                tttp_scancode scancode) {
-                                           GetInputDelegate().Text(sofar,
-                                                                   sofarlen);
-                                           GetInputDelegate().Key(1, scancode);
-                                           GetInputDelegate().Key(0, scancode);
-                                              });
-        if(outp != buf) GetInputDelegate().Text(buf, outp-buf);
+                                              &controls);
+        for_each_cp437_span(buf, outp, controls,
+                            [this](uint8_t* run, size_t runlen) {
+                              GetInputDelegate().Text(run, runlen);
+                            },
+                            [this](tttp_scancode scancode) {
+                              GetInputDelegate().Key(1, scancode);
+                              GetInputDelegate().Key(0, scancode);
+                            });
         wait = false;
       }
       break;
@@ -692,8 +853,19 @@ char* SDLSoft_Display::GetOtherClipboardText() {
 #if defined(SDL_VIDEO_DRIVER_X11)
   SDL_SysWMinfo info;
   SDL_VERSION(&info.version);
-  if(SDL_GetWindowWMInfo(window, &info) && info.subsystem == SDL_SYSWM_X11) {
-    /* Try using xclip to read the selection. Don't try very hard. */
+  if(primary_selection) {
+    // whatever we have; if it hasn't arrived yet, don't wait for it
+    auto& text = primary_selection->text;
+    if(primary_selection->requesting || text.empty()) return nullptr;
+    char* ret = reinterpret_cast<char*>(safe_malloc(text.size()+1));
+    memcpy(ret, text.data(), text.size());
+    ret[text.size()] = 0;
+    return ret;
+  }
+  else if(SDL_GetWindowWMInfo(window, &info)
+          && info.subsystem == SDL_SYSWM_X11) {
+    /* No XFixes. Try using xclip to read the selection. Don't try very
+       hard. */
     FILE* xclip = popen("xclip -o -selection primary", "r");
     if(xclip) {
       std::vector<char> text;
@@ -728,3 +900,35 @@ void SDLSoft_Display::SetOverlayTexture(SDL_Texture* tex, int w, int h) {
 void SDLSoft_Display::SetOverlayRegion(int x, int y, int w, int h) {
   overlay_x = x; overlay_y = y; overlay_w = w; overlay_h = h;
 }
+
+void SDLSoft_Display::SetOverlayClip(int x, int y, int w, int h) {
+  overlay_clip_x = x; overlay_clip_y = y;
+  overlay_clip_w = w; overlay_clip_h = h;
+}
+
+void SDLSoft_Display::DirtyOverlay() {
+  if(cur_width == 0 || cur_height == 0) return;
+  int l = overlay_x, t = overlay_y;
+  int r = overlay_x + overlay_w - 1, b = overlay_y + overlay_h - 1;
+  if(overlay_clip_w >= 0) {
+    if(l < overlay_clip_x) l = overlay_clip_x;
+    if(t < overlay_clip_y) t = overlay_clip_y;
+    if(r >= overlay_clip_x+overlay_clip_w) r = overlay_clip_x+overlay_clip_w-1;
+    if(b >= overlay_clip_y+overlay_clip_h) b = overlay_clip_y+overlay_clip_h-1;
+  }
+  if(l < 0) l = 0;
+  if(t < 0) t = 0;
+  if(r < l || b < t) return;
+  // from pixels to the cells they touch
+  l /= glyph_width; r /= glyph_width;
+  t /= glyph_height; b /= glyph_height;
+  if(r >= cur_width) r = cur_width - 1;
+  if(b >= cur_height) b = cur_height - 1;
+  if(r < l || b < t) return;
+  // just widening the dirty region is enough; Pump copies all of it from the
+  // frame texture and then draws the overlay over it
+  if(l < dirty_left) dirty_left = l;
+  if(t < dirty_top) dirty_top = t;
+  if(r > dirty_right) dirty_right = r;
+  if(b > dirty_bot) dirty_bot = b;
+}
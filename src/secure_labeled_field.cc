@@ -83,7 +83,7 @@ SecureLabeledField::~SecureLabeledField() {}
 void SecureLabeledField::Clear() {
   content.clear();
   cursor_pos = 0;
-  Draw();
+  Invalidate();
 }
 
 void SecureLabeledField::Draw() {
@@ -131,27 +131,25 @@ void SecureLabeledField::HandleText(const uint8_t* text, size_t textlen) {
     content.insert(cursor_pos++, 1, *text);
     ++text; --textlen;
   }
-  Draw();
+  Invalidate();
 }
 
 void SecureLabeledField::HandlePaste() {
   char* cbt = container.GetDisplay().GetClipboardText();
   if(!cbt) return;
   auto cbtlen = strlen(cbt);
+  std::vector<cp437_control> controls;
   // overwrite the buffer as we go, it's okay, CP437 is shorter than UTF-8
-  uint8_t* cop = convert_utf8_to_cp437(reinterpret_cast<uint8_t*>(cbt),
-                                       reinterpret_cast<uint8_t*>(cbt),
-                                       cbtlen,
-                                       [this](uint8_t* sofar,
-                                              size_t sofarlen,
-                                              tttp_scancode code){
-                                         HandleText(sofar, sofarlen);
-                                         if(code != KEY_ENTER
-                                            && code != KEY_TAB)
-                                           HandleKey(code);
-                                       });
-  auto outlen = cop - reinterpret_cast<uint8_t*>(cbt);
-  if(outlen > 0) HandleText(reinterpret_cast<uint8_t*>(cbt), outlen);
+  uint8_t* text = reinterpret_cast<uint8_t*>(cbt);
+  uint8_t* end = convert_utf8_to_cp437(text, text, cbtlen, &controls);
+  for_each_cp437_span(text, end, controls,
+                      [this](uint8_t* run, size_t runlen) {
+                        HandleText(run, runlen);
+                      },
+                      [this](tttp_scancode code) {
+                        if(code != KEY_ENTER && code != KEY_TAB)
+                          HandleKey(code);
+                      });
   lsx_explicit_bzero(cbt, cbtlen);
   container.GetDisplay().FreeClipboardText(cbt);
 }
@@ -165,22 +163,22 @@ void SecureLabeledField::HandleKey(tttp_scancode scancode) {
     if(container.IsControlHeld()) HandlePaste();
     break;
   case KEY_DELETE:
-    if(cursor_pos < content.length()) { content.erase(cursor_pos, 1); Draw(); }
+    if(cursor_pos < content.length()) { content.erase(cursor_pos, 1); Invalidate(); }
     break;
   case KEY_BACKSPACE:
-    if(cursor_pos > 0) { content.erase(--cursor_pos, 1); Draw(); }
+    if(cursor_pos > 0) { content.erase(--cursor_pos, 1); Invalidate(); }
     break;
   case KEY_LEFT:
-    if(cursor_pos > 0) { --cursor_pos; Draw(); }
+    if(cursor_pos > 0) { --cursor_pos; Invalidate(); }
     break;
   case KEY_RIGHT:
-    if(cursor_pos < content.length()) { ++cursor_pos; Draw(); }
+    if(cursor_pos < content.length()) { ++cursor_pos; Invalidate(); }
     break;
   case KEY_HOME:
-    if(cursor_pos > 0) { cursor_pos = 0; Draw(); }
+    if(cursor_pos > 0) { cursor_pos = 0; Invalidate(); }
     break;
   case KEY_END:
-    if(cursor_pos < content.length()) { cursor_pos = content.length(); Draw();}
+    if(cursor_pos < content.length()) { cursor_pos = content.length(); Invalidate();}
     break;
   case KEY_KEYPAD_ENTER:
   case KEY_ENTER:
@@ -201,21 +199,19 @@ void SecureLabeledField::HandleClick(uint16_t button) {
     char* cbt = container.GetDisplay().GetOtherClipboardText();
     if(!cbt) return;
     auto cbtlen = strlen(cbt);
+    std::vector<cp437_control> controls;
     // overwrite the buffer as we go, it's okay, CP437 is shorter than UTF-8
-    uint8_t* cop = convert_utf8_to_cp437(reinterpret_cast<uint8_t*>(cbt),
-                                         reinterpret_cast<uint8_t*>(cbt),
-                                         cbtlen,
-                                         [this](uint8_t* sofar,
-                                                size_t sofarlen,
-                                                tttp_scancode code){
-                                           HandleText(sofar, sofarlen);
-                                           if(code != KEY_ENTER
-                                              && code != KEY_TAB
-                                              && code != KEY_ESCAPE)
-                                             HandleKey(code);
-                                         });
-    auto outlen = cop - reinterpret_cast<uint8_t*>(cbt);
-    if(outlen > 0) HandleText(reinterpret_cast<uint8_t*>(cbt), outlen);
+    uint8_t* text = reinterpret_cast<uint8_t*>(cbt);
+    uint8_t* end = convert_utf8_to_cp437(text, text, cbtlen, &controls);
+    for_each_cp437_span(text, end, controls,
+                        [this](uint8_t* run, size_t runlen) {
+                          HandleText(run, runlen);
+                        },
+                        [this](tttp_scancode code) {
+                          if(code != KEY_ENTER && code != KEY_TAB
+                             && code != KEY_ESCAPE)
+                            HandleKey(code);
+                        });
     lsx_explicit_bzero(cbt, cbtlen);
     container.GetDisplay().FreeOtherClipboardText(cbt);
   }
@@ -0,0 +1,353 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "session.hh"
+#include "display.hh"
+#include "widgets.hh"
+#include "mac16.hh"
+#include "charconv.hh"
+#include "recording.hh"
+#include "startup.hh"
+
+
+namespace {
+  // copies one rectangle of both planes of a frame laid out the way
+  // Display::Update takes it
+  void copy_frame_rect(uint8_t* dst, const uint8_t* src,
+                       uint16_t width, uint16_t height,
+                       uint16_t left, uint16_t top,
+                       uint16_t rect_width, uint16_t rect_height) {
+    if(left >= width || top >= height) return;
+    if(rect_width > width - left) rect_width = width - left;
+    if(rect_height > height - top) rect_height = height - top;
+    size_t plane_size = size_t(width) * height;
+    for(int plane = 0; plane < 2; ++plane) {
+      size_t offset = plane * plane_size + size_t(top) * width + left;
+      for(uint16_t row = 0; row < rect_height; ++row) {
+        memcpy(dst + offset, src + offset, rect_width);
+        offset += width;
+      }
+    }
+  }
+}
+
+class LibTTTPInputDelegate : public InputDelegate {
+  Session& session;
+  Display& display;
+  bool left_shift_held, right_shift_held;
+  bool left_control_held, right_control_held;
+  bool left_gui_held, right_gui_held;
+  bool left_alt_held, right_alt_held;
+  // the last Escape press cancelled a paste rather than going to the server
+  bool escape_eaten;
+  bool ShiftHeld() const { return left_shift_held || right_shift_held; }
+  bool ControlHeld() const { return left_control_held || right_control_held; }
+  bool GuiHeld() const { return left_gui_held || right_gui_held; }
+  bool AltHeld() const { return left_alt_held || right_alt_held; }
+  bool CheckMods(bool shift, bool control, bool gui, bool alt) {
+    return ShiftHeld() == shift && ControlHeld() == control
+      && GuiHeld() == gui && AltHeld() == alt;
+  }
+  tttp_client* tttp() { return session.GetClient(); }
+public:
+  LibTTTPInputDelegate(Session& session)
+    : session(session), display(session.GetDisplay()),
+      left_shift_held(false), right_shift_held(false),
+      left_control_held(false), right_control_held(false),
+      left_gui_held(false), right_gui_held(false),
+      left_alt_held(false), right_alt_held(false), escape_eaten(false) {}
+  void Key(int pressed, tttp_scancode scancode) override {
+    if(scancode == KEY_LEFT_SHIFT) left_shift_held = pressed;
+    else if(scancode == KEY_RIGHT_SHIFT) right_shift_held = pressed;
+    else if(scancode == KEY_LEFT_CONTROL) left_control_held = pressed;
+    else if(scancode == KEY_RIGHT_CONTROL) right_control_held = pressed;
+    else if(scancode == KEY_LEFT_GUI) left_gui_held = pressed;
+    else if(scancode == KEY_RIGHT_GUI) right_gui_held = pressed;
+    else if(scancode == KEY_LEFT_ALT) left_alt_held = pressed;
+    else if(scancode == KEY_RIGHT_ALT) right_alt_held = pressed;
+    // Escape cancels a paste in progress instead of going to the server;
+    // the server never saw that press, so it mustn't see its release either
+    else if(scancode == KEY_ESCAPE && pressed
+            && session.GetPaste().IsActive()) {
+      session.GetPaste().Cancel();
+      escape_eaten = true;
+      return;
+    }
+    else if(scancode == KEY_ESCAPE && !pressed && escape_eaten) {
+      escape_eaten = false;
+      return;
+    }
+    // scroll lock is supposed to be a toggle, so a physical "press" could
+    // generate either a press or a release; allow both to quit
+    else if(pressed || scancode == KEY_SCROLL_LOCK) {
+      /* QUIT
+         All platforms: Control+Backslash, Control+Pause, Control+ScrollLock
+         Mac: Command+Q, Command+W
+         Non-Mac: Alt+F4
+      */
+      if((scancode == KEY_BACKSLASH && CheckMods(false,true,false,false))
+         || (scancode == KEY_PAUSE && CheckMods(false,true,false,false))
+         || (scancode == KEY_SCROLL_LOCK && CheckMods(false,true,false,false))
+#if MACOSX
+         || ((scancode == KEY_W || scancode == KEY_Q)
+             && CheckMods(false,false,true,false))
+#else
+         || (scancode == KEY_F4 && CheckMods(false,false,false,true))
+#endif
+         ) {
+        throw quit_exception();
+      }
+      /*
+        STATISTICS
+        Mac: Command+F12
+        Non-Mac: Control+F12
+      */
+      else if(scancode == KEY_F12
+#if MACOSX
+              && CheckMods(false,false,true,false)
+#else
+              && CheckMods(false,true,false,false)
+#endif
+              ) {
+        session.ToggleStats();
+        return;
+      }
+      /*
+        MESSAGES
+        Mac: Command+F11
+        Non-Mac: Control+F11
+      */
+      else if(scancode == KEY_F11
+#if MACOSX
+              && CheckMods(false,false,true,false)
+#else
+              && CheckMods(false,true,false,false)
+#endif
+              ) {
+        session.ToggleMessages();
+        return;
+      }
+      /*
+        PASTE
+        All platforms: Shift+Insert
+        Mac: Command+V
+        Non-Mac: Control+V
+       */
+      else if(session.IsPastingEnabled()
+         && ((scancode == KEY_INSERT && CheckMods(true,false,false,false))
+#if MACOSX
+             || (scancode == KEY_V && CheckMods(false,false,true,false))
+#else
+             || (scancode == KEY_V && CheckMods(false,true,false,false))
+#endif
+             )) {
+        char* cbt = display.GetClipboardText();
+        session.GetPaste().Start(cbt ? cbt : "", cbt ? strlen(cbt) : 0);
+        if(cbt) display.FreeClipboardText(cbt);
+        return;
+      }
+    }
+    tttp_client_send_key(tttp(), pressed ? TTTP_PRESS : TTTP_RELEASE,
+                         scancode);
+  }
+  void Text(uint8_t* text, size_t textlen) override {
+    tttp_client_send_text(tttp(), text, textlen);
+  }
+  void MouseMove(int16_t x, int16_t y) override {
+    tttp_client_send_mouse_movement(tttp(), x, y);
+  }
+  void MouseButton(int pressed, uint16_t button) override {
+    tttp_client_send_mouse_button(tttp(),
+                                  pressed ? TTTP_PRESS : TTTP_RELEASE,
+                                  button);
+    if(session.IsPastingEnabled()) {
+      char* cbt = display.GetOtherClipboardText();
+      if(cbt && *cbt != 0) session.GetPaste().Start(cbt, strlen(cbt));
+      if(cbt) display.FreeOtherClipboardText(cbt);
+    }
+  }
+  void Scroll(int8_t x, int8_t y) override {
+    tttp_client_send_scroll(tttp(), x, y);
+  }
+};
+
+Session::Session(Display& display)
+  : display(display), socks{&socket}, tttp(nullptr), pasting_enabled(false),
+    paste(*this), input_delegate(new LibTTTPInputDelegate(*this)),
+    frames_received(0), stats_enabled(false), messages_visible(false),
+    frame_width(0), frame_height(0) {}
+
+Session::~Session() {
+  ForgetConnection(*this);
+  if(tttp) tttp_client_fini(tttp);
+}
+
+void Session::SetClient(tttp_client* client) {
+  paste.Abandon();
+  if(tttp) tttp_client_fini(tttp);
+  tttp = client;
+  pasting_enabled = false;
+}
+
+void Session::Start() {
+  tttp_client_set_core_callbacks(tttp, PaletteCallback, FrameCallback,
+                                 KickCallback);
+  tttp_client_set_text_callback(tttp, TextCallback);
+  tttp_client_set_paste_mode_callback(tttp, PasteModeCallback);
+  display.SetInputDelegate(input_delegate.get());
+}
+
+bool Session::Pump() {
+  if(!tttp || !tttp_client_pump(tttp)) return false;
+  // the paste's progress gets the status line while it lasts
+  if(!paste.Step() && stats_enabled) UpdateStats();
+  return true;
+}
+
+void Session::ToggleStats() {
+  stats_enabled = !stats_enabled;
+  if(stats_enabled) {
+    last_stats_time = std::chrono::steady_clock::now();
+    last_display_stats = display.GetStats();
+    last_bytes_received = conn.bytes_received;
+    last_frames_received = frames_received;
+    display.Statusf("Collecting statistics...");
+  }
+  else display.Statusf("");
+}
+
+void Session::ToggleMessages() {
+  messages_visible = !messages_visible;
+  ShowFrame(0, 0, frame_width, frame_height);
+}
+
+void Session::ShowFrame(uint16_t dirty_left, uint16_t dirty_top,
+                        uint16_t dirty_width, uint16_t dirty_height) {
+  if(frame.empty()) return;
+  if(!messages_visible) {
+    display.Update(frame_width, frame_height, dirty_left, dirty_top,
+                   dirty_width, dirty_height, frame.data());
+    return;
+  }
+  // composed_frame is only kept in step while the panel is showing; after a
+  // resize, or when the panel has just appeared, it is all dirty anyway
+  if(composed_frame.size() != frame.size()) {
+    composed_frame = frame;
+    dirty_left = dirty_top = 0;
+    dirty_width = frame_width;
+    dirty_height = frame_height;
+  }
+  else
+    copy_frame_rect(composed_frame.data(), frame.data(),
+                    frame_width, frame_height,
+                    dirty_left, dirty_top, dirty_width, dirty_height);
+  uint16_t panel_top = messages.Draw(frame_width, frame_height,
+                                     composed_frame.data());
+  if(panel_top >= frame_height) {
+    display.Update(frame_width, frame_height, dirty_left, dirty_top,
+                   dirty_width, dirty_height, composed_frame.data());
+    return;
+  }
+  // the panel is redrawn every time, and spans the whole width, so the
+  // dirty region is whatever changed joined with the panel's rows
+  uint16_t dirty_bot = frame_height - 1;
+  if(dirty_width != 0 && dirty_height != 0) {
+    if(dirty_top + dirty_height > dirty_bot)
+      dirty_bot = dirty_top + dirty_height;
+    if(panel_top < dirty_top) dirty_top = panel_top;
+  }
+  else dirty_top = panel_top;
+  display.Update(frame_width, frame_height, 0, dirty_top, frame_width,
+                 dirty_bot - dirty_top, composed_frame.data());
+}
+
+void Session::UpdateStats() {
+  auto now = std::chrono::steady_clock::now();
+  if(now - last_stats_time < std::chrono::seconds(1)) return;
+  double seconds = std::chrono::duration<double>(now - last_stats_time)
+    .count();
+  const Display::Stats& cur = display.GetStats();
+  uint64_t updates = cur.updates - last_display_stats.updates;
+  double rasterize_ms = std::chrono::duration<double, std::milli>
+    (cur.rasterize_time - last_display_stats.rasterize_time).count();
+  display.Statusf("%.1fKiB/s %.1f fram/s %.1f pres/s %.2fms/rast"
+                  " %u coal %u drop",
+                  (conn.bytes_received - last_bytes_received) / seconds
+                  / 1024,
+                  (frames_received - last_frames_received) / seconds,
+                  (cur.presents - last_display_stats.presents) / seconds,
+                  updates ? rasterize_ms / updates : 0.0,
+                  (unsigned)(cur.coalesced - last_display_stats.coalesced),
+                  (unsigned)(cur.dropped - last_display_stats.dropped));
+  last_stats_time = now;
+  last_display_stats = cur;
+  last_bytes_received = conn.bytes_received;
+  last_frames_received = frames_received;
+}
+
+void Session::PaletteCallback(void* d, const uint8_t* colors) {
+  Session& session = *reinterpret_cast<Session*>(d);
+  if(Recording::Active()) Recording::Palette(colors);
+  session.display.SetPalette(colors);
+}
+
+void Session::FrameCallback(void* d, uint32_t width, uint32_t height,
+                            uint32_t dirty_left, uint32_t dirty_top,
+                            uint32_t dirty_width, uint32_t dirty_height,
+                            void* framedata) {
+  Session& session = *reinterpret_cast<Session*>(d);
+  ++session.frames_received;
+  if(Recording::Active())
+    Recording::Frame(width, height, dirty_left, dirty_top, dirty_width,
+                     dirty_height, reinterpret_cast<uint8_t*>(framedata));
+  const uint8_t* src = reinterpret_cast<const uint8_t*>(framedata);
+  if(width != session.frame_width || height != session.frame_height) {
+    session.frame_width = width;
+    session.frame_height = height;
+    session.frame.assign(src, src + size_t(width) * height * 2);
+    session.ShowFrame(0, 0, width, height);
+    return;
+  }
+  // only the dirty rectangle can differ from what we already have
+  copy_frame_rect(session.frame.data(), src, width, height,
+                  dirty_left, dirty_top, dirty_width, dirty_height);
+  session.ShowFrame(dirty_left, dirty_top, dirty_width, dirty_height);
+}
+
+void Session::KickCallback(void* d, const uint8_t* data, size_t len) {
+  Session& session = *reinterpret_cast<Session*>(d);
+  std::string text(reinterpret_cast<const char*>(data), len);
+  session.display.SetPalette(mac16);
+  Widgets::ModalInfo(session.display,
+                     std::string("We were kicked by the server.\n\n")
+                     + (len ? text : std::string("No reason was given.")));
+  throw quit_exception();
+}
+
+void Session::TextCallback(void* d, const uint8_t* data, size_t len) {
+  Session& session = *reinterpret_cast<Session*>(d);
+  if(Recording::Active()) Recording::Text(data, len);
+  session.messages.Add(data, len);
+  if(session.messages_visible)
+    session.ShowFrame(0, 0, 0, 0);
+}
+
+void Session::PasteModeCallback(void* d, int enabled) {
+  Session& session = *reinterpret_cast<Session*>(d);
+  session.pasting_enabled = enabled;
+  if(!enabled) session.paste.Cancel();
+}
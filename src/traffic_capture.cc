@@ -0,0 +1,149 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "traffic_capture.hh"
+#include "threads.hh"
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <errno.h>
+
+static const size_t RING_SIZE = 4 << 20;
+// includes the direction byte
+static const uint32_t SNAPLEN = 65536;
+static const uint32_t LINKTYPE_USER0 = 147;
+
+static FILE* capture_file = nullptr;
+static std::thread writer;
+static std::mutex ring_lock;
+static std::condition_variable ring_cond;
+static std::vector<uint8_t> ring;
+// these only ever increase; the ring positions are these modulo RING_SIZE
+// everything from `ring_tail` up to `ring_head` is waiting to be written
+static uint64_t ring_head, ring_tail;
+static bool stopping, write_failed;
+static uint64_t dropped_packets;
+
+static void write_loop() {
+  std::unique_lock<std::mutex> lock(ring_lock);
+  while(true) {
+    while(ring_head == ring_tail && !stopping) ring_cond.wait(lock);
+    if(ring_head == ring_tail) break;
+    size_t start = ring_tail % RING_SIZE;
+    size_t amount = std::min<uint64_t>(ring_head - ring_tail,
+                                       RING_SIZE - start);
+    // Record never touches the region between the tail and the head, so we
+    // can write it out without holding the lock
+    lock.unlock();
+    if(!write_failed
+       && fwrite(ring.data() + start, 1, amount, capture_file) != amount)
+      write_failed = true;
+    lock.lock();
+    ring_tail += amount;
+  }
+}
+
+// call with ring_lock held, after making sure there is room
+static void ring_put(const void* data, size_t len) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+  while(len > 0) {
+    size_t start = ring_head % RING_SIZE;
+    size_t amount = std::min(len, RING_SIZE - start);
+    memcpy(ring.data() + start, p, amount);
+    ring_head += amount;
+    p += amount;
+    len -= amount;
+  }
+}
+
+void TrafficCapture::Start(const char* path) {
+  Stop();
+  capture_file = fopen(path, "wb");
+  if(!capture_file)
+    throw std::string("Opening ") + path + ": " + strerror(errno);
+  // pcap global header, in our native byte order (readers check the magic)
+  struct {
+    uint32_t magic;
+    uint16_t version_major, version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs, snaplen, network;
+  } header = {0xA1B2C3D4, 2, 4, 0, 0, SNAPLEN, LINKTYPE_USER0};
+  static_assert(sizeof(header) == 24, "pcap header must be 24 bytes");
+  if(fwrite(&header, sizeof(header), 1, capture_file) != 1) {
+    fclose(capture_file);
+    capture_file = nullptr;
+    throw std::string("Writing ") + path + ": " + strerror(errno);
+  }
+  ring.resize(RING_SIZE);
+  ring_head = ring_tail = 0;
+  stopping = write_failed = false;
+  dropped_packets = 0;
+  writer = std::thread(write_loop);
+}
+
+void TrafficCapture::Stop() {
+  if(capture_file == nullptr) return;
+  {
+    std::lock_guard<std::mutex> lock(ring_lock);
+    stopping = true;
+  }
+  ring_cond.notify_one();
+  writer.join();
+  if(fclose(capture_file)) write_failed = true;
+  capture_file = nullptr;
+  std::vector<uint8_t>().swap(ring);
+  if(write_failed)
+    std::cerr << "Warning: the traffic capture could not be completely written"
+              << std::endl;
+  if(dropped_packets)
+    std::cerr << "Warning: " << dropped_packets << " packets were dropped from"
+      " the traffic capture" << std::endl;
+}
+
+bool TrafficCapture::Active() {
+  return capture_file != nullptr;
+}
+
+void TrafficCapture::Record(bool received, const void* data, size_t len) {
+  auto since_epoch = std::chrono::system_clock::now().time_since_epoch();
+  auto usec = std::chrono::duration_cast<std::chrono::microseconds>
+    (since_epoch).count();
+  size_t snapped = std::min<size_t>(len, SNAPLEN - 1);
+  uint32_t packet_header[4] = {(uint32_t)(usec / 1000000),
+                               (uint32_t)(usec % 1000000),
+                               (uint32_t)(snapped + 1),
+                               (uint32_t)std::min<size_t>(len + 1,
+                                                          0xFFFFFFFF)};
+  uint8_t direction = received ? 1 : 0;
+  bool dropped = false;
+  {
+    std::lock_guard<std::mutex> lock(ring_lock);
+    if(RING_SIZE - (ring_head - ring_tail)
+       < sizeof(packet_header) + 1 + snapped) {
+      ++dropped_packets;
+      dropped = true;
+    }
+    else {
+      ring_put(packet_header, sizeof(packet_header));
+      ring_put(&direction, 1);
+      ring_put(data, snapped);
+    }
+  }
+  if(!dropped) ring_cond.notify_one();
+}
@@ -0,0 +1,583 @@
+/*
+  Copyright (C) 2015-2016 Solra Bizna
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* tttp-loadgen opens many TTTP sessions to one server from a single process,
+   with no display, feeds them scripted input, and reports how each one
+   fared. It exists for capacity planning; unlike tttpclient, it trusts
+   whatever public key the server presents. */
+
+#include "tttpclient.hh"
+#include "tttp_client.h"
+#include "tttp_scancodes.h"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+#if __linux__
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+extern void die(const char* format, ...) {
+  char error[1920];
+  va_list arg;
+  va_start(arg, format);
+  vsnprintf(error, sizeof(error), format, arg);
+  va_end(arg);
+  throw std::string(error);
+}
+
+extern "C" tttp_thread_local_block* tttp_get_thread_local_block() {
+  static thread_local tttp_thread_local_block b;
+  return &b;
+}
+
+#if __linux__
+
+typedef std::chrono::steady_clock loadgen_clock;
+
+static const char* target = nullptr;
+static const char* username = "";
+static const char* password = "";
+static bool no_auth = false, no_crypt = false;
+static long session_count = 10, duration = 30;
+static double key_rate = 2, mouse_rate = 0;
+
+// the keys we press, in order, over and over
+static const tttp_scancode script_keys[] = {
+  KEY_RIGHT, KEY_DOWN, KEY_LEFT, KEY_UP, KEY_SPACE,
+};
+
+namespace {
+  enum class State {
+    CONNECTING, QUERY, FLAGS, AUTH, VERIFY, RUNNING, FAILED
+  };
+  class Session {
+    int fd;
+    tttp_client* tttp = nullptr;
+    uint8_t public_key[TTTP_PUBLIC_KEY_LENGTH];
+    size_t next_key = 0;
+    // size of the last frame received, for picking mouse positions
+    uint32_t frame_width = 80, frame_height = 24;
+    // when each input not yet answered by a frame was sent
+    std::vector<loadgen_clock::time_point> unanswered;
+    static int receive(void* d, void* buf, size_t bufsz);
+    static int send(void* d, const void* buf, size_t bufsz);
+    static void fatal(void*, const char* why);
+    static void foul(void*, const char* why);
+    static void pltt(void*, const uint8_t*) {}
+    static void fram(void* d, uint32_t, uint32_t, uint32_t, uint32_t,
+                     uint32_t, uint32_t, void*);
+    static void kick(void* d, const uint8_t* data, size_t len);
+    void Advance();
+    void Fail(const std::string& why);
+  public:
+    int id;
+    State state = State::CONNECTING;
+    std::string failure;
+    uint64_t bytes_received = 0, frames = 0;
+    loadgen_clock::time_point running_since, stopped_at;
+    loadgen_clock::time_point next_key_time, next_mouse_time;
+    std::vector<uint32_t> latencies_us;
+    Session(int id, int fd) : fd(fd), id(id) {}
+    ~Session() {
+      if(tttp) tttp_client_fini(tttp);
+      if(fd >= 0) close(fd);
+    }
+    int GetFD() const { return fd; }
+    void Readable();
+    void Writable();
+    void SendScriptedInput(loadgen_clock::time_point now);
+  };
+}
+
+int Session::receive(void* d, void* buf, size_t bufsz) {
+  Session& self = *reinterpret_cast<Session*>(d);
+  ssize_t red = recv(self.fd, buf, bufsz, 0);
+  if(red < 0) {
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+    return -1;
+  }
+  else if(red == 0) return -1;
+  self.bytes_received += red;
+  return red;
+}
+
+// input is small, so on the rare occasion the socket buffer is full, we just
+// wait for it
+int Session::send(void* d, const void* buf, size_t bufsz) {
+  Session& self = *reinterpret_cast<Session*>(d);
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(buf);
+  while(bufsz > 0) {
+    ssize_t wrote = ::send(self.fd, p, bufsz, MSG_NOSIGNAL);
+    if(wrote < 0) {
+      if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        struct pollfd pfd = {self.fd, POLLOUT, 0};
+        (void)poll(&pfd, 1, -1);
+        continue;
+      }
+      return -1;
+    }
+    p += wrote;
+    bufsz -= wrote;
+  }
+  return 0;
+}
+
+void Session::fatal(void*, const char* why) {
+  throw std::string("libtttp error: ") + why;
+}
+
+void Session::foul(void*, const char* why) {
+  throw std::string("server error: ") + why;
+}
+
+void Session::kick(void*, const uint8_t* data, size_t len) {
+  throw std::string("kicked: ") + std::string(reinterpret_cast<const char*>
+                                              (data), len);
+}
+
+void Session::fram(void* d, uint32_t width, uint32_t height,
+                   uint32_t, uint32_t, uint32_t, uint32_t, void*) {
+  Session& self = *reinterpret_cast<Session*>(d);
+  ++self.frames;
+  if(width > 0 && height > 0) {
+    self.frame_width = width;
+    self.frame_height = height;
+  }
+  if(!self.unanswered.empty()) {
+    auto now = loadgen_clock::now();
+    for(auto sent : self.unanswered)
+      self.latencies_us.push_back
+        (std::chrono::duration_cast<std::chrono::microseconds>(now - sent)
+         .count());
+    self.unanswered.clear();
+  }
+}
+
+void Session::Fail(const std::string& why) {
+  if(state == State::FAILED) return;
+  if(state == State::RUNNING) stopped_at = loadgen_clock::now();
+  state = State::FAILED;
+  failure = why;
+  if(tttp) {
+    tttp_client_fini(tttp);
+    tttp = nullptr;
+  }
+  // closing the socket also takes it out of the epoll set
+  close(fd);
+  fd = -1;
+}
+
+void Session::Writable() {
+  if(state != State::CONNECTING) return;
+  int err = 0;
+  socklen_t errlen = sizeof(err);
+  if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) || err) {
+    Fail(std::string("connect: ") + strerror(err ? err : errno));
+    return;
+  }
+  tttp = tttp_client_init(this, receive, send, nullptr, fatal, foul);
+  tttp_client_set_core_callbacks(tttp, pltt, fram, kick);
+  memset(public_key, 0, sizeof(public_key));
+  if(no_auth) {
+    tttp_client_request_flags(tttp, TTTP_FLAG_PRECISE_MOUSE);
+    state = State::FLAGS;
+  }
+  else state = State::QUERY;
+  Advance();
+}
+
+void Session::Readable() {
+  if(state == State::CONNECTING) return;
+  Advance();
+}
+
+void Session::Advance() {
+  try {
+    while(true) {
+      tttp_handshake_result res;
+      switch(state) {
+      case State::CONNECTING:
+      case State::FAILED:
+        return;
+      case State::QUERY:
+        res = tttp_client_query_server(tttp, public_key, nullptr, nullptr);
+        if(res == TTTP_HANDSHAKE_CONTINUE) return;
+        else if(res == TTTP_HANDSHAKE_REJECTED)
+          return Fail("the server's public key is hidden");
+        else if(res != TTTP_HANDSHAKE_ADVANCE)
+          return Fail("handshake error while querying the server");
+        tttp_client_request_flags(tttp, TTTP_FLAG_PRECISE_MOUSE |
+                                  (no_crypt ? 0 : TTTP_FLAG_ENCRYPTION));
+        state = State::FLAGS;
+        break;
+      case State::FLAGS:
+        res = tttp_client_pump_flags(tttp);
+        if(res == TTTP_HANDSHAKE_CONTINUE) return;
+        else if(res != TTTP_HANDSHAKE_ADVANCE)
+          return Fail("handshake error while negotiating flags");
+        if(tttp_client_get_flags(tttp)
+           & ~(TTTP_FLAG_ENCRYPTION|TTTP_FLAG_PRECISE_MOUSE))
+          return Fail("the server requires an unsupported extension");
+        if(no_auth) {
+          tttp_client_begin_handshake(tttp, nullptr, public_key);
+          state = State::VERIFY;
+        }
+        else {
+          tttp_client_begin_handshake(tttp, username, public_key);
+          state = State::AUTH;
+        }
+        break;
+      case State::AUTH:
+        res = tttp_client_pump_auth(tttp);
+        if(res == TTTP_HANDSHAKE_CONTINUE) return;
+        else if(res == TTTP_HANDSHAKE_REJECTED)
+          return Fail("the server rejected the username");
+        else if(res != TTTP_HANDSHAKE_ADVANCE)
+          return Fail("handshake error during authentication");
+        tttp_client_provide_password(tttp, password, strlen(password));
+        state = State::VERIFY;
+        break;
+      case State::VERIFY:
+        res = tttp_client_pump_verify(tttp);
+        if(res == TTTP_HANDSHAKE_CONTINUE) return;
+        else if(res == TTTP_HANDSHAKE_REJECTED)
+          return Fail("authentication failed");
+        else if(res != TTTP_HANDSHAKE_ADVANCE)
+          return Fail("handshake error during verification");
+        state = State::RUNNING;
+        running_since = next_key_time = next_mouse_time = loadgen_clock::now();
+        break;
+      case State::RUNNING: {
+        // keep pumping for as long as it keeps finding data; epoll is level
+        // triggered, so anything we leave behind will wake us again anyway
+        uint64_t before;
+        do {
+          before = bytes_received;
+          if(!tttp_client_pump(tttp))
+            return Fail("the server closed the connection");
+        } while(bytes_received != before);
+        return;
+      }
+      }
+    }
+  }
+  catch(std::string why) {
+    Fail(why);
+  }
+}
+
+void Session::SendScriptedInput(loadgen_clock::time_point now) {
+  if(state != State::RUNNING) return;
+  try {
+    if(key_rate > 0 && now >= next_key_time) {
+      tttp_scancode key = script_keys[next_key++ % (sizeof(script_keys)
+                                                    / sizeof(*script_keys))];
+      tttp_client_send_key(tttp, TTTP_PRESS, key);
+      tttp_client_send_key(tttp, TTTP_RELEASE, key);
+      unanswered.push_back(now);
+      next_key_time += std::chrono::microseconds((int64_t)(1000000
+                                                           / key_rate));
+    }
+    if(mouse_rate > 0 && now >= next_mouse_time) {
+      tttp_client_send_mouse_movement(tttp, rand() % frame_width,
+                                      rand() % frame_height);
+      unanswered.push_back(now);
+      next_mouse_time += std::chrono::microseconds((int64_t)(1000000
+                                                             / mouse_rate));
+    }
+  }
+  catch(std::string why) {
+    Fail(why);
+  }
+}
+
+static bool parse_number(const char* opt, const char* arg, double min,
+                         double max, double& out) {
+  char* endptr;
+  double d = strtod(arg, &endptr);
+  if(*endptr || endptr == arg || !(d >= min && d <= max)) {
+    std::cerr << "Argument for " << opt << " must be between " << min
+              << " and " << max << std::endl;
+    return false;
+  }
+  out = d;
+  return true;
+}
+
+static int parse_command_line(int argc, char* argv[]) {
+  ++argv;
+  --argc;
+  int ret = 0;
+  while(argc > 0) {
+    if(**argv == '-') {
+      char* arg = *argv;
+      ++argv;
+      --argc;
+      while(*++arg) {
+        char opt[3] = {'-', *arg, 0};
+        double d;
+        switch(*arg) {
+        default:
+          std::cerr << "Unknown option: " << *arg << std::endl;
+          // fall through
+        case '?':
+          ret = 1;
+          break;
+        case 'U': no_auth = no_crypt = true; break;
+        case 'E': no_crypt = true; break;
+        case 'n': case 'd': case 'k': case 'm': case 'u': case 'p':
+          if(argc <= 0) {
+            std::cerr << "No argument given for " << opt << std::endl;
+            ret = 1;
+            break;
+          }
+          switch(*arg) {
+          case 'n':
+            if(parse_number(opt, *argv, 1, 65536, d)) session_count = d;
+            else ret = 1;
+            break;
+          case 'd':
+            if(parse_number(opt, *argv, 1, 86400, d)) duration = d;
+            else ret = 1;
+            break;
+          case 'k':
+            if(!parse_number(opt, *argv, 0, 1000, key_rate)) ret = 1;
+            break;
+          case 'm':
+            if(!parse_number(opt, *argv, 0, 1000, mouse_rate)) ret = 1;
+            break;
+          case 'u': username = *argv; break;
+          case 'p': password = *argv; break;
+          }
+          ++argv; --argc;
+          break;
+        }
+      }
+    }
+    else if(target == nullptr) {
+      target = *argv++;
+      --argc;
+    }
+    else {
+      std::cerr << "More than one server specified" << std::endl;
+      ++argv;
+      --argc;
+    }
+  }
+  if(target == nullptr) {
+    std::cerr << "A server must be specified" << std::endl;
+    ret = 1;
+  }
+  if(ret) {
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << "  tttp-loadgen <host>[:port] [options...]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  -n <count>: Number of sessions to open. (default: 10)" << std::endl;
+    std::cerr << "  -d <seconds>: How long to run. (default: 30)" << std::endl;
+    std::cerr << "  -k <rate>: Keystrokes per second, per session. (default: 2)" << std::endl;
+    std::cerr << "  -m <rate>: Mouse movements per second, per session. (default: 0)" << std::endl;
+    std::cerr << "  -u <user>: Authenticate as the given user. (default: empty, which" << std::endl;
+    std::cerr << "authenticates as a guest)" << std::endl;
+    std::cerr << "  -p <password>: Authenticate with the given password." << std::endl;
+    std::cerr << "  -U: Do not attempt authentication (or encryption)." << std::endl;
+    std::cerr << "  -E: Do not attempt encryption." << std::endl;
+  }
+  return ret;
+}
+
+static struct addrinfo* resolve_target() {
+  std::string host = target, port = std::to_string(TTTP_STANDARD_PORT);
+  // "host:port", "[v6 address]:port", "[v6 address]", or just a host
+  auto colon = host.rfind(':');
+  if(host[0] == '[') {
+    auto bracket = host.find(']');
+    if(bracket == std::string::npos) die("Invalid server address: %s",target);
+    if(bracket + 1 < host.length() && host[bracket + 1] == ':')
+      port = host.substr(bracket + 2);
+    host = host.substr(1, bracket - 1);
+  }
+  else if(colon != std::string::npos && host.find(':') == colon) {
+    port = host.substr(colon + 1);
+    host = host.substr(0, colon);
+  }
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* res;
+  int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+  if(err) die("Could not resolve %s: %s", target, gai_strerror(err));
+  return res;
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, int pct) {
+  if(sorted.empty()) return 0;
+  return sorted[std::min(sorted.size() - 1, sorted.size() * pct / 100)];
+}
+
+static void print_row(std::ostream& out, const std::string& label,
+                      const std::string& state, uint64_t frames,
+                      uint64_t bytes, double seconds,
+                      std::vector<uint32_t>& latencies) {
+  std::sort(latencies.begin(), latencies.end());
+  if(seconds <= 0) seconds = 1e-9;
+  out << std::setw(8) << label << std::setw(9) << state
+      << std::setw(9) << frames
+      << std::setw(9) << std::setprecision(1) << frames / seconds
+      << std::setw(11) << std::setprecision(1) << bytes / seconds / 1024
+      << std::setw(9) << std::setprecision(2)
+      << percentile(latencies, 50) / 1000.0
+      << std::setw(9) << percentile(latencies, 90) / 1000.0
+      << std::setw(9) << percentile(latencies, 99) / 1000.0 << std::endl;
+}
+
+static int run() {
+  struct addrinfo* addresses = resolve_target();
+  int epfd = epoll_create1(0);
+  if(epfd < 0) die("epoll_create1: %s", strerror(errno));
+  std::vector<std::unique_ptr<Session>> sessions;
+  for(long n = 0; n < session_count; ++n) {
+    int fd = -1;
+    for(auto p = addresses; p != nullptr; p = p->ai_next) {
+      fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK,
+                  p->ai_protocol);
+      if(fd < 0) continue;
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      if(connect(fd, p->ai_addr, p->ai_addrlen) == 0 || errno == EINPROGRESS)
+        break;
+      close(fd);
+      fd = -1;
+    }
+    sessions.emplace_back(new Session(n, fd));
+    Session& session = *sessions.back();
+    if(fd < 0) {
+      session.state = State::FAILED;
+      session.failure = "could not connect";
+      continue;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = &session;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+      die("epoll_ctl: %s", strerror(errno));
+  }
+  freeaddrinfo(addresses);
+  auto start = loadgen_clock::now();
+  auto end = start + std::chrono::seconds(duration);
+  std::vector<struct epoll_event> events(256);
+  while(true) {
+    auto now = loadgen_clock::now();
+    if(now >= end) break;
+    int n = epoll_wait(epfd, events.data(), events.size(), 10);
+    if(n < 0 && errno != EINTR) die("epoll_wait: %s", strerror(errno));
+    for(int i = 0; i < n; ++i) {
+      Session& session = *reinterpret_cast<Session*>(events[i].data.ptr);
+      if(session.state == State::CONNECTING) {
+        if(events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+          session.Writable();
+          if(session.GetFD() >= 0) {
+            // from now on, we only care about incoming data
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = &session;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, session.GetFD(), &ev);
+          }
+        }
+      }
+      else session.Readable();
+    }
+    now = loadgen_clock::now();
+    for(auto& session : sessions) session->SendScriptedInput(now);
+  }
+  auto stop = loadgen_clock::now();
+  close(epfd);
+  std::cout << std::fixed << std::setw(8) << "session" << std::setw(9)
+            << "state" << std::setw(9) << "frames" << std::setw(9) << "fps"
+            << std::setw(11) << "KiB/s" << std::setw(9) << "p50 ms"
+            << std::setw(9) << "p90 ms" << std::setw(9) << "p99 ms"
+            << std::endl;
+  uint64_t total_frames = 0, total_bytes = 0;
+  double total_seconds = 0;
+  int running = 0;
+  std::vector<uint32_t> all_latencies;
+  for(auto& session : sessions) {
+    double seconds = 0;
+    if(session->state == State::RUNNING)
+      seconds = std::chrono::duration<double>(stop - session->running_since)
+        .count();
+    else if(session->stopped_at != loadgen_clock::time_point())
+      seconds = std::chrono::duration<double>(session->stopped_at
+                                              - session->running_since)
+        .count();
+    if(session->state == State::RUNNING) ++running;
+    total_frames += session->frames;
+    total_bytes += session->bytes_received;
+    total_seconds += seconds;
+    all_latencies.insert(all_latencies.end(), session->latencies_us.begin(),
+                         session->latencies_us.end());
+    print_row(std::cout, std::to_string(session->id),
+              session->state == State::RUNNING ? "ok" : "FAILED",
+              session->frames, session->bytes_received, seconds,
+              session->latencies_us);
+    if(session->state != State::RUNNING)
+      std::cout << "          " << (session->failure.empty()
+                                    ? "did not finish its handshake"
+                                    : session->failure) << std::endl;
+  }
+  // the "all" row shows per-session averages, not totals
+  if(!sessions.empty())
+    print_row(std::cout, "all", std::to_string(running) + "/"
+              + std::to_string(sessions.size()),
+              total_frames, total_bytes,
+              total_seconds > 0 ? total_seconds : 1, all_latencies);
+  for(auto& session : sessions) session.reset();
+  return running == (int)sessions.size() ? 0 : 1;
+}
+
+int teg_main(int argc, char* argv[]) {
+  if(parse_command_line(argc, argv)) return 1;
+  tttp_init();
+  try {
+    return run();
+  }
+  catch(std::string s) {
+    std::cerr << s << std::endl;
+    return 1;
+  }
+}
+
+#else
+
+int teg_main(int, char*[]) {
+  std::cerr << "tttp-loadgen is only supported on Linux." << std::endl;
+  return 1;
+}
+
+#endif
@@ -27,19 +27,25 @@
 #include "widgets.hh"
 #include "pkdb.hh"
 #include "io.hh"
-#include "charconv.hh"
+#include "recording.hh"
+#include "traffic_capture.hh"
+#include "session.hh"
 
 #include <iostream>
-#include <lsx.h>
+#include <chrono>
+#include <algorithm>
 
 static const char* font_path = nullptr;
 static const char* window_title = nullptr;
+static const char* record_path = nullptr, *replay_path = nullptr;
+static const char* capture_path = nullptr;
+static const char* import_path = nullptr, *export_path = nullptr;
+static bool replay_max_speed = false;
 int queue_depth = -1;
 char* autohost = nullptr, *autouser = nullptr, *autopassword = nullptr,
   *autopassfile = nullptr;
-bool no_auth = false, no_crypt = false;
-Net::SockStream server_socket;
-tttp_client* tttp = nullptr;
+bool no_auth = false, no_crypt = false, handshake_stats = false,
+  auto_reconnect = false;
 
 static enum class DisplayMode {
   DEFAULT, ACCELERATED
@@ -48,169 +54,105 @@ static float max_fps = -1;
 static bool have_max_fps = false;
 
 static Display* display = nullptr;
-static bool pasting_enabled = false;
 
-class LibTTTPInputDelegate : public InputDelegate {
-  bool left_shift_held, right_shift_held;
-  bool left_control_held, right_control_held;
-  bool left_gui_held, right_gui_held;
-  bool left_alt_held, right_alt_held;
-  bool ShiftHeld() const { return left_shift_held || right_shift_held; }
-  bool ControlHeld() const { return left_control_held || right_control_held; }
-  bool GuiHeld() const { return left_gui_held || right_gui_held; }
-  bool AltHeld() const { return left_alt_held || right_alt_held; }
-  bool CheckMods(bool shift, bool control, bool gui, bool alt) {
-    return ShiftHeld() == shift && ControlHeld() == control
-      && GuiHeld() == gui && AltHeld() == alt;
-  }
-public:
-  LibTTTPInputDelegate()
-    : left_shift_held(false), right_shift_held(false),
-      left_control_held(false), right_control_held(false),
-      left_gui_held(false), right_gui_held(false),
-      left_alt_held(false), right_alt_held(false) {}
-  void Key(int pressed, tttp_scancode scancode) override {
-    if(scancode == KEY_LEFT_SHIFT) left_shift_held = pressed;
-    else if(scancode == KEY_RIGHT_SHIFT) right_shift_held = pressed;
-    else if(scancode == KEY_LEFT_CONTROL) left_control_held = pressed;
-    else if(scancode == KEY_RIGHT_CONTROL) right_control_held = pressed;
-    else if(scancode == KEY_LEFT_GUI) left_gui_held = pressed;
-    else if(scancode == KEY_RIGHT_GUI) right_gui_held = pressed;
-    else if(scancode == KEY_LEFT_ALT) left_alt_held = pressed;
-    else if(scancode == KEY_RIGHT_ALT) right_alt_held = pressed;
-    // scroll lock is supposed to be a toggle, so a physical "press" could
-    // generate either a press or a release; allow both to quit
-    else if(pressed || scancode == KEY_SCROLL_LOCK) {
-      /* QUIT
-         All platforms: Control+Backslash, Control+Pause, Control+ScrollLock
-         Mac: Command+Q, Command+W
-         Non-Mac: Alt+F4
-      */
-      if((scancode == KEY_BACKSLASH && CheckMods(false,true,false,false))
-         || (scancode == KEY_PAUSE && CheckMods(false,true,false,false))
-         || (scancode == KEY_SCROLL_LOCK && CheckMods(false,true,false,false))
-#if MACOSX
-         || ((scancode == KEY_W || scancode == KEY_Q)
-             && CheckMods(false,false,true,false))
-#else
-         || (scancode == KEY_F4 && CheckMods(false,false,false,true))
-#endif
-         ) {
-        throw quit_exception();
-      }
-      /*
-        PASTE
-        All platforms: Shift+Insert
-        Mac: Command+V
-        Non-Mac: Control+V
-       */
-      else if(pasting_enabled
-         && ((scancode == KEY_INSERT && CheckMods(true,false,false,false))
-#if MACOSX
-             || (scancode == KEY_V && CheckMods(false,false,true,false))
-#else
-             || (scancode == KEY_V && CheckMods(false,true,false,false))
-#endif
-             )) {
-        char* cbt = display->GetClipboardText();
-        tttp_client_begin_paste(tttp);
-        if(cbt) {
-          auto cbtlen = strlen(cbt);
-          // overwrite the buffer as we go, it's okay
-          uint8_t* cop = convert_utf8_to_cp437(reinterpret_cast<uint8_t*>(cbt),
-                                               reinterpret_cast<uint8_t*>(cbt),
-                                               cbtlen,
-                                               [this](uint8_t* sofar,
-                                                      size_t sofarlen,
-                                                      tttp_scancode code){
-                                                 Text(sofar, sofarlen);
-                                                 if(code == KEY_ENTER
-                                                    || code == KEY_TAB) {
-                                                   Key(1, code); Key(0, code);
-                                                 }
-                                               });
-          auto outlen = cop - reinterpret_cast<uint8_t*>(cbt);
-          if(outlen > 0) Text(reinterpret_cast<uint8_t*>(cbt), outlen);
-          display->FreeClipboardText(cbt);
-        }
-        tttp_client_end_paste(tttp);
-        return;
-      }
+// the first retry waits this long, and each one after that waits twice as
+// long as the last, up to the maximum
+static const std::chrono::milliseconds MIN_RECONNECT_DELAY(250);
+static const std::chrono::milliseconds MAX_RECONNECT_DELAY(30000);
+
+// true: we're connected again; false: we gave up, and `err` says why
+static bool reconnect(Session& session, std::string& err) {
+  Display& display = session.GetDisplay();
+  DiscardingInputDelegate del;
+  display.SetInputDelegate(&del);
+  auto delay = MIN_RECONNECT_DELAY;
+  for(int attempt = 1; ; ++attempt) {
+    display.Statusf("Connection lost. Reconnecting in %.1f seconds..."
+                    " (attempt %i)", delay.count() / 1000.0, attempt);
+    auto until = std::chrono::steady_clock::now() + delay;
+    while(true) {
+      int remaining_ms = (int)std::chrono::duration_cast
+        <std::chrono::milliseconds>(until - std::chrono::steady_clock::now())
+        .count();
+      if(remaining_ms <= 0) break;
+      display.Pump(true, remaining_ms);
     }
-    tttp_client_send_key(tttp, pressed ? TTTP_PRESS : TTTP_RELEASE, scancode);
-  }
-  void Text(uint8_t* text, size_t textlen) override {
-    tttp_client_send_text(tttp, text, textlen);
-  }
-  void MouseMove(int16_t x, int16_t y) override {
-    tttp_client_send_mouse_movement(tttp, x, y);
-  }
-  void MouseButton(int pressed, uint16_t button) override {
-    tttp_client_send_mouse_button(tttp, pressed ? TTTP_PRESS : TTTP_RELEASE,
-                                  button);
-    if(pasting_enabled) {
-      /* there are six instances of slightly different code to do this in this
-         program, I should really have made this generic */
-      char* cbt = display->GetOtherClipboardText();
-      if(cbt && *cbt != 0) {
-        tttp_client_begin_paste(tttp);
-        auto cbtlen = strlen(cbt);
-        //overwrite the buffer as we go, it's okay, CP437 is shorter than UTF-8
-        uint8_t* cop = convert_utf8_to_cp437(reinterpret_cast<uint8_t*>(cbt),
-                                             reinterpret_cast<uint8_t*>(cbt),
-                                             cbtlen,
-                                             [this](uint8_t* sofar,
-                                                    size_t sofarlen,
-                                                    tttp_scancode code){
-                                               Text(sofar, sofarlen);
-                                               if(code == KEY_ENTER
-                                                  || code == KEY_TAB) {
-                                                 Key(1, code); Key(0, code);
-                                               }
-                                             });
-        auto outlen = cop - reinterpret_cast<uint8_t*>(cbt);
-        if(outlen > 0) Text(reinterpret_cast<uint8_t*>(cbt), outlen);
-        tttp_client_end_paste(tttp);
-      }
-      if(cbt) display->FreeOtherClipboardText(cbt);
+    auto result = Reconnect(session, err);
+    if(result == ConnResult::OK) {
+      display.SetInputDelegate(nullptr);
+      return true;
     }
+    else if(result != ConnResult::CONN_FAILURE) {
+      display.Statusf("");
+      display.SetInputDelegate(nullptr);
+      return false;
+    }
+    delay = std::min(delay * 2, MAX_RECONNECT_DELAY);
   }
-  void Scroll(int8_t x, int8_t y) override {
-    tttp_client_send_scroll(tttp, x, y);
-  }
-};
-
-static void pltt_callback(void* d, const uint8_t* colors) {
-  Display* display = reinterpret_cast<Display*>(d);
-  display->SetPalette(colors);
-}
-
-static void fram_callback(void* d, uint32_t width, uint32_t height,
-                          uint32_t dirty_left, uint32_t dirty_top,
-                          uint32_t dirty_width, uint32_t dirty_height,
-                          void* framedata) {
-  Display* display = reinterpret_cast<Display*>(d);
-  display->Update(width, height, dirty_left, dirty_top, dirty_width,
-                  dirty_height, reinterpret_cast<uint8_t*>(framedata));
 }
 
-static void kick_callback(void* d, const uint8_t* data, size_t len) {
-  Display* display = reinterpret_cast<Display*>(d);
-  std::string text(reinterpret_cast<const char*>(data), len);
-  display->SetPalette(mac16);
-  Widgets::ModalInfo(*display,
-                     std::string("We were kicked by the server.\n\n")
-                     + (len ? text : std::string("No reason was given.")));
-  throw quit_exception();
-}
-
-static void text_callback(void*, const uint8_t* data, size_t len) {
+// there's no Session during playback, so recorded text messages just go to
+// standard output
+static void print_replay_text(void*, const uint8_t* data, size_t len) {
   std::cout << "TEXT: " << std::string(reinterpret_cast<const char*>(data),
                                        len);
 }
 
-static void pmode_callback(void*, int enabled) {
-  pasting_enabled = enabled;
+// -i and -o; returns the exit status
+static int transfer_host_keys() {
+  std::string err;
+  PKDB::BulkStats stats;
+  if(import_path != nullptr) {
+    bool is_stdin = !strcmp(import_path, "-");
+    FILE* f = is_stdin ? stdin : fopen(import_path, "r");
+    if(f == nullptr) {
+      std::cerr << import_path << ": " << strerror(errno) << std::endl;
+      return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    bool ok = PKDB::Import(f, stats, err);
+    double seconds = std::chrono::duration<double>
+      (std::chrono::steady_clock::now() - start).count();
+    if(!is_stdin) fclose(f);
+    if(!ok) {
+      std::cerr << "Importing host keys failed: " << err << std::endl;
+      return 1;
+    }
+    std::cerr << "Imported " << stats.rows << " host keys in " << seconds
+              << " seconds (" << (seconds > 0 ? stats.rows / seconds : 0)
+              << " rows/sec)" << std::endl;
+    if(stats.bad_lines)
+      std::cerr << "Skipped " << stats.bad_lines << " lines that were not a"
+                << " server address and a valid public key, starting with"
+                << " line " << stats.first_bad_line << std::endl;
+  }
+  if(export_path != nullptr) {
+    bool is_stdout = !strcmp(export_path, "-");
+    FILE* f = is_stdout ? stdout : fopen(export_path, "w");
+    if(f == nullptr) {
+      std::cerr << export_path << ": " << strerror(errno) << std::endl;
+      PKDB::Fini();
+      return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    bool ok = PKDB::Export(f, stats, err);
+    double seconds = std::chrono::duration<double>
+      (std::chrono::steady_clock::now() - start).count();
+    if(!is_stdout && fclose(f) && ok) {
+      ok = false;
+      err = "Could not write the host key file.";
+    }
+    if(!ok) {
+      std::cerr << "Exporting host keys failed: " << err << std::endl;
+      PKDB::Fini();
+      return 1;
+    }
+    std::cerr << "Exported " << stats.rows << " host keys in " << seconds
+              << " seconds (" << (seconds > 0 ? stats.rows / seconds : 0)
+              << " rows/sec)" << std::endl;
+  }
+  PKDB::Fini();
+  return 0;
 }
 
 extern void die(const char* format, ...) {
@@ -308,6 +250,85 @@ static int parse_command_line(int argc, char* argv[]) {
           }
           no_crypt = true;
           break;
+        case 'S':
+          handshake_stats = true;
+          break;
+        case 'A':
+          auto_reconnect = true;
+          break;
+        case 'R':
+          if(argc <= 0) {
+            std::cerr << "No argument given for -R" << std::endl;
+            ret = 1;
+          }
+          else if(record_path != nullptr) {
+            std::cerr << "-R given more than once" << std::endl;
+            ret = 1;
+          }
+          else {
+            record_path = *argv++;
+            --argc;
+          }
+          break;
+        case 'Y':
+          if(argc <= 0) {
+            std::cerr << "No argument given for -Y" << std::endl;
+            ret = 1;
+          }
+          else if(replay_path != nullptr) {
+            std::cerr << "-Y given more than once" << std::endl;
+            ret = 1;
+          }
+          else {
+            replay_path = *argv++;
+            --argc;
+          }
+          break;
+        case 'M':
+          replay_max_speed = true;
+          break;
+        case 'i':
+          if(argc <= 0) {
+            std::cerr << "No argument given for -i" << std::endl;
+            ret = 1;
+          }
+          else if(import_path != nullptr) {
+            std::cerr << "-i given more than once" << std::endl;
+            ret = 1;
+          }
+          else {
+            import_path = *argv++;
+            --argc;
+          }
+          break;
+        case 'o':
+          if(argc <= 0) {
+            std::cerr << "No argument given for -o" << std::endl;
+            ret = 1;
+          }
+          else if(export_path != nullptr) {
+            std::cerr << "-o given more than once" << std::endl;
+            ret = 1;
+          }
+          else {
+            export_path = *argv++;
+            --argc;
+          }
+          break;
+        case 'C':
+          if(argc <= 0) {
+            std::cerr << "No argument given for -C" << std::endl;
+            ret = 1;
+          }
+          else if(capture_path != nullptr) {
+            std::cerr << "-C given more than once" << std::endl;
+            ret = 1;
+          }
+          else {
+            capture_path = *argv++;
+            --argc;
+          }
+          break;
         case 'p':
           if(argc <= 0) {
             std::cerr << "No argument given for -p" << std::endl;
@@ -414,13 +435,23 @@ static int parse_command_line(int argc, char* argv[]) {
       --argc;
     }
   }
-  if(font_path == nullptr) {
+  if(font_path == nullptr && import_path == nullptr
+     && export_path == nullptr) {
     std::cerr << "A font must be specified" << std::endl;
     ret = 1;
   }
+  if(replay_path != nullptr && record_path != nullptr) {
+    std::cerr << "Only one of -R, -Y is allowed" << std::endl;
+    ret = 1;
+  }
+  if(replay_max_speed && replay_path == nullptr) {
+    std::cerr << "-M is only meaningful with -Y" << std::endl;
+    ret = 1;
+  }
   if(ret) {
     std::cerr << "Usage:" << std::endl;
     std::cerr << "  tttpclient <font path> [options...]" << std::endl;
+    std::cerr << "  tttpclient [-i <path>] [-o <path>]" << std::endl;
     std::cerr << "The font must be a PNG containing all 256 glyphs of codepage 437, packed" << std::endl;
     std::cerr << "tightly in 8 columns and 8 rows. The glyph size is autodetected, and may not" << std::endl;
     std::cerr << "be greater than 255x255." << std::endl;
@@ -446,6 +477,27 @@ static int parse_command_line(int argc, char* argv[]) {
     std::cerr << "file as a password. Warning: This file should only be readable by you, and" << std::endl;
     std::cerr << "should not have a filename others can use to find an identical file, for" << std::endl;
     std::cerr << "reasons given above." << std::endl;
+    std::cerr << "  -S: After each connection attempt, print how long each phase of the" << std::endl;
+    std::cerr << "handshake took, and how much of that was spent waiting on the network." << std::endl;
+    std::cerr << "  -A: If the connection is lost, keep trying to reconnect with the same" << std::endl;
+    std::cerr << "username and password. The password is kept in memory for as long as the" << std::endl;
+    std::cerr << "client runs." << std::endl;
+    std::cerr << "  -R <path>: Record everything the server displays into a file." << std::endl;
+    std::cerr << "  -Y <path>: Instead of connecting, play back a file recorded with -R, and" << std::endl;
+    std::cerr << "report the frame rate achieved." << std::endl;
+    std::cerr << "  -M: With -Y, play back as fast as possible instead of in real time." << std::endl;
+    std::cerr << "  -C <path>: Capture all traffic to and from the server into a pcap file." << std::endl;
+    std::cerr << "Unless -E is also given, most of it will be encrypted." << std::endl;
+    std::cerr << "  -i <path>: Instead of connecting, add every host key in the given file to the" << std::endl;
+    std::cerr << "public key database, replacing any keys already on file for those hosts. Each" << std::endl;
+    std::cerr << "line of the file is a server address and a base64 public key, separated by" << std::endl;
+    std::cerr << "whitespace. Use - to read standard input." << std::endl;
+    std::cerr << "  -o <path>: Instead of connecting, write every host key in the public key" << std::endl;
+    std::cerr << "database into the given file, in the same format -i reads. Use - to write" << std::endl;
+    std::cerr << "standard output. With -i, this happens after the import." << std::endl;
+    std::cerr << "While connected, " PMOD "+F12 toggles a display of throughput and frame" << std::endl;
+    std::cerr << "rate statistics on the status line, and " PMOD "+F11 shows or hides" << std::endl;
+    std::cerr << "the most recent text messages from the server." << std::endl;
   }
   return ret;
 }
@@ -457,6 +509,11 @@ int teg_main(int argc, char* argv[]) {
   if(parse_command_line(argc, argv)) return 1;
   if(no_auth) no_crypt = true;
   tttp_init();
+  if(import_path != nullptr || export_path != nullptr)
+    return transfer_host_keys();
+  // opening the database can take a while (especially if the home directory
+  // is on the network), so do it while the font loads and the window opens
+  if(!no_auth && replay_path == nullptr) PKDB::StartInit();
   try {
     {
       Font font(font_path);
@@ -466,25 +523,48 @@ int teg_main(int argc, char* argv[]) {
                                     max_fps);
     }
     display->SetPalette(mac16);
+    if(replay_path != nullptr) {
+      DiscardingInputDelegate del;
+      display->SetInputDelegate(&del);
+      auto stats = Recording::Replay(*display, replay_path, !replay_max_speed,
+                                     print_replay_text);
+      std::cerr << "Played back " << stats.frames << " frames, "
+                << stats.palettes << " palette changes and " << stats.texts
+                << " text messages in " << stats.seconds << " seconds ("
+                << (stats.seconds > 0 ? stats.frames / stats.seconds : 0)
+                << " frames/sec)" << std::endl;
+      display->SetInputDelegate(nullptr);
+      delete display;
+      return 0;
+    }
+    if(capture_path != nullptr) TrafficCapture::Start(capture_path);
     std::string err;
     if(!no_auth && !PKDB::Init(*display, err)) {
       Widgets::ModalInfo(*display, std::string("Could not initialize the public key database: \"") + err + "\"\n\nAuthentication and encryption are not available.", MAC16_BLACK|(MAC16_RED<<4));
       if(autouser || autopassword || autopassfile) throw quit_exception();
       no_crypt = no_auth = true;
     }
-    if(DoConnectionDialog(*display)) {
+    Session session(*display);
+    if(DoConnectionDialog(session)) {
       PKDB::Fini();
-      LibTTTPInputDelegate del;
-      tttp_client_set_core_callbacks(tttp, pltt_callback, fram_callback,
-                                     kick_callback);
-      tttp_client_set_text_callback(tttp, text_callback);
-      tttp_client_set_paste_mode_callback(tttp, pmode_callback);
-      display->SetInputDelegate(&del);
-      while(tttp_client_pump(tttp))
-        display->Pump();
+      if(record_path != nullptr) Recording::Start(record_path);
+      std::string reconnect_err;
+      while(true) {
+        session.Start();
+        while(session.Pump())
+          display->Pump();
+        if(!auto_reconnect || !reconnect(session, reconnect_err)) break;
+      }
+      Recording::Stop();
       display->SetPalette(mac16);
-      Widgets::ModalInfo(*display,
-                         "The connection to the server was closed.");
+      if(reconnect_err.empty())
+        Widgets::ModalInfo(*display,
+                           "The connection to the server was closed.");
+      else
+        Widgets::ModalInfo(*display,
+                           "The connection to the server was closed, and"
+                           " could not be reestablished.\n\n"
+                           + reconnect_err, MAC16_BLACK|(MAC16_ORANGE<<4));
     }
   }
   catch(std::string s) {
@@ -514,6 +594,10 @@ int teg_main(int argc, char* argv[]) {
         " exception." << std::endl << std::endl << s2 << std::endl;
     }
   }
+  Recording::Stop();
+  TrafficCapture::Stop();
+  // writes out any host key changes that are still pending
+  PKDB::Fini();
   if(display != nullptr) delete display;
   return 0;
 }
@@ -22,12 +22,14 @@
 using namespace Widgets;
 
 Widget::Widget(Container& container, int x, int y, int w, int h)
-  : focused(false), container(container), x(x), y(y), w(w), h(h) {}
+  : focused(false), dirty(false), container(container),
+    x(x), y(y), w(w), h(h) {}
 Widget::~Widget() {}
 
-void Widget::Draw() { container.DirtyRect(x, y, w, h); }
-void Widget::OnGainFocus() { focused = true; Draw(); }
-void Widget::OnLoseFocus() { focused = false; Draw(); }
+void Widget::Draw() { container.DirtyRect(x, y, w, h); dirty = false; }
+void Widget::Invalidate() { dirty = true; container.any_widget_dirty = true; }
+void Widget::OnGainFocus() { focused = true; Invalidate(); }
+void Widget::OnLoseFocus() { focused = false; Invalidate(); }
 void Widget::HandleText(const uint8_t* text, size_t textlen) {
   (void)text; (void)textlen;
 }
@@ -65,6 +67,7 @@ void Widget::HandleKey(tttp_scancode scancode) {
 void Widget::HandleClick(uint16_t button) {
   if(button == TTTP_LEFT_MOUSE_BUTTON) container.SetFocusedWidget(GetMyself());
 }
+void Widget::HandleScroll(int8_t x, int8_t y) { (void)x; (void)y; }
 bool Widget::IsEnabled() const { return false; }
 
 std::shared_ptr<Widget> Widget::GetMyself() const {